@@ -0,0 +1,59 @@
+/*
+Arena
+----------------
+arena.js
+
+Bump allocator for algorithm scratch space. An arena owns one Float64Array;
+alloc hands out consecutive slices of it and reset gives everything back at
+once. cat.js keeps one arena per test and resets it for every new candidate,
+so algorithms can take scratch arrays inside the test loop without creating
+new buffers once the arena has grown to the size the test needs.
+
+*/
+
+/*
+@createArena
+@params length (initial number of float64 slots, default 4096)
+
+Returns { alloc(n), reset(), used }.
+alloc(n) returns a zero filled Float64Array view of n slots, valid until the
+next reset. When the arena runs out it doubles; views handed out before the
+growth keep pointing at the old storage, which stays valid until reset.
+
+*/
+
+var createArena = function(length){
+	var storage = new Float64Array(length || 4096),
+		top = 0;
+
+	var arena = {
+		used: 0,
+
+		alloc: function(n){
+			if (top + n > storage.length){
+				var size = storage.length;
+				while (size < n) size *= 2;
+				storage = new Float64Array(size * 2);
+				top = 0;
+			}
+
+			var view = storage.subarray(top, top + n);
+			view.fill(0);
+			top += n;
+			arena.used += n;
+			return view;
+		},
+
+		reset: function(){
+			top = 0;
+			arena.used = 0;
+		}
+	};
+
+	return arena;
+}
+
+
+module.exports = {
+	createArena: createArena
+};
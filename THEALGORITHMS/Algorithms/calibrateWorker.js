@@ -0,0 +1,15 @@
+/*
+Calibrate Worker
+----------------
+calibrateWorker.js
+
+Worker thread entry for calibrateSympsonHetter in sympsonHetter.js. Simulates
+one slice of the population and records into its shard of the shared
+exposure counters.
+
+*/
+
+var workerThreads = require('worker_threads');
+var sympsonHetter = require('./sympsonHetter');
+
+sympsonHetter.simulateExposure(workerThreads.workerData);
@@ -71,8 +71,8 @@ A Methodology Whose Time Has Come.
 
 var fs = require('fs');
 var readline = require('readline');
-var readlineSync = require('readline-sync');
-// var itemResponse = require('/itemResponse');
+var itemResponse = require('./itemResponse');
+var arena = require('./arena');
 
 
 //JSON card bank
@@ -90,6 +90,16 @@ var D = 0,
 	testStandard = 0, //Pass/Fail Standard
 	tLength = 0;
 
+var administeredItems = [], // Bank index of each item given to the current candidate
+	administeredScores = []; // and its score
+
+// Scratch space for algorithms during one candidate's test, reset by newCandidate
+var testArena = arena.createArena();
+
+var scratch = function(n){
+	return testArena.alloc(n);
+}
+
 
 var student = {
 	name: "Owen",
@@ -98,6 +108,7 @@ var student = {
 var item = "";
 
 var testLength = 5; //Test length
+var verbose = true; //Print each step. Turned off when replaying many sessions
 // var itemBank = []; // Item Bank to choose from
 // var candidateBank = []; //student Test bank
 
@@ -157,7 +168,255 @@ var candidateBank = [
 
 // Dummy Data ====================================================================
 
+/**
+@useItemBank
+@param items, models (optional model keys to freeze, default ["rasch"]),
+       precision (optional, "float32" for compact tables of very large banks)
+
+Makes items the bank to select from and records each item's bank position
+in item.index, used by algorithms and the response log. items can also be a
+bank opened with openBankFile (itemBank.js): its difficulty column, bitmaps
+and parameter columns are used directly and an item object is only built
+when bankItem asks for it, so a large bank file starts without one object
+per item. Freezes the bank:
+difficulties go into one Float64Array, bank positions sorted by difficulty
+(O(n log n), once per bank) let findItemInBank binary search, every item
+characteristic gets a bank length bitmap (see characteristicBitmap) and each
+model key gets a frozen parameter table (see freezeItemTable in
+itemResponse.js) that criteria read with the bank index,
+bankTable(model).b[item.index].
+Call it again after changing the bank.
+**/
+
+var bankDifficulty = new Float64Array(0),
+	bankOrder = new Uint32Array(0), // Bank positions sorted by (difficulty, position)
+	bankOrderLength = 0, // Items in bankOrder; retired items are taken out
+	characteristicBitmaps = Object.create(null), // Characteristic name -> Uint32Array, bit i for item i
+	bankWords = 0, // Uint32 words in a bank length bitmap
+	retiredBitmap = new Uint32Array(0), // Bit i set once item i is retired
+	bankTables = Object.create(null),
+	bankPrecision,
+	openedBank = null; // The openBankFile bank the items come from, if any
+
+var algorithms = []; // Registered algorithms, see registerAlgorithm
+
+// Runs the bankSize hooks before the bank grows or a test starts on it
+var checkBankSize = function(items){
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].bankSize) algorithms[a].bankSize(items);
+	}
+}
+
+var useItemBank = function(items, models, precision){
+	var n = items.length;
+
+	checkBankSize(n);
+	characteristicBitmaps = Object.create(null);
+	bankWords = Math.ceil(n / 32);
+	retiredBitmap = new Uint32Array(bankWords);
+
+	if (Array.isArray(items)){
+		openedBank = null;
+		itemBank = items;
+		bankDifficulty = new Float64Array(n);
+		items.forEach(function(bankItem, i){
+			bankItem.index = i;
+			bankDifficulty[i] = bankItem.difficulty;
+			if (bankItem.retired) retiredBitmap[i >>> 5] |= 1 << (i & 31);
+		});
+		items.forEach(indexCharacteristics);
+	}
+	else {
+		// Filled in by bankItem as items are asked for
+		openedBank = items;
+		itemBank = new Array(n);
+		bankDifficulty = Float64Array.from(items.difficulty);
+		for (var name in items.characteristics){
+			var c = items.characteristics[name];
+			characteristicBitmaps[name] = items.bitmaps.slice(c * items.words, (c + 1) * items.words);
+		}
+	}
+
+	bankOrder = sortByDifficulty(bankDifficulty);
+	bankOrderLength = n;
+	bankPrecision = precision;
+	bankTables = Object.create(null);
+	(models || ["rasch"]).forEach(function(model){
+		bankTables[model] = freezeBank(model);
+	});
+}
+
+/**
+@freezeBank
+@param model
+
+Frozen table of the whole bank for the model. An opened bank file is read
+from its columns, items added since (addItem) from their objects.
+**/
+
+var freezeBank = function(model){
+	var table = itemResponse.freezeItemTable(openedBank || itemBank, model, bankPrecision);
+	for (var i = table.length; i < itemBank.length; i++) appendParameters(table, itemBank[i], model);
+	return table;
+}
+
+var appendParameters = function(table, item, model){
+	var index = table.length,
+		p = itemResponse.itemParameters(item, model);
+	table.a = grow(table.a, index + 1);
+	table.b = grow(table.b, index + 1);
+	table.c = grow(table.c, index + 1);
+	table.a[index] = p.a;
+	table.b[index] = p.b;
+	table.c[index] = p.c;
+	table.length = index + 1;
+}
+
+/**
+@sortByDifficulty
+@param difficulty (Float64Array)
+
+Bank positions ordered by difficulty, ties by position.
+**/
+
+var sortByDifficulty = function(difficulty){
+	var order = new Uint32Array(difficulty.length);
+	for (var i = 0; i < order.length; i++) order[i] = i;
+
+	return order.sort(function(x, y){
+		return (difficulty[x] - difficulty[y]) || (x - y);
+	});
+}
+
+/**
+@grow
+@param array (typed array), length
+
+Returns array if it can hold length entries, else a copy with double the room.
+**/
+
+var grow = function(array, length){
+	if (array.length >= length) return array;
+	var grown = new array.constructor(Math.max(length, 2 * array.length));
+	grown.set(array);
+	return grown;
+}
+
+/**
+@indexCharacteristics
+@param item
+
+Sets the item's bit in the bitmap of each of its characteristics.
+**/
+
+var indexCharacteristics = function(item){
+	(item.characteristics || []).forEach(function(name){
+		var bitmap = grow(characteristicBitmaps[name] || new Uint32Array(0), bankWords);
+		bitmap[item.index >>> 5] |= 1 << (item.index & 31);
+		characteristicBitmaps[name] = bitmap;
+	});
+}
+
+/**
+@characteristicBitmap
+@param name
+
+Bitmap of the items with that characteristic (bit i of word i >>> 5 for bank
+position i). Words past the end of the returned array are all zero; unknown
+names give an empty array.
+**/
+
+var emptyBitmap = new Uint32Array(0);
+
+var characteristicBitmap = function(name){
+	return characteristicBitmaps[name] || emptyBitmap;
+}
+
+var getBankWords = function(){
+	return bankWords;
+}
+
+var bankItem = function(index){
+	var item = itemBank[index];
+	if (item === undefined && openedBank && index < openedBank.length){
+		item = itemBank[index] = openedBank.item(index);
+	}
+	return item;
+}
+
+// Whether the item at this bank position was retired, without building it
+var isRetired = function(index){
+	return (retiredBitmap[index >>> 5] & (1 << (index & 31))) != 0;
+}
+
+// Bank positions of the items the current candidate has been given, in order
+var getAdministeredItems = function(){
+	return administeredItems;
+}
+
+/**
+@addItem
+@param item
+
+Adds an item to the live bank without rebuilding it. The item takes the next
+bank position, its parameters are appended to the frozen tables and it is
+slotted into the difficulty order with one binary search and one shift of
+the order array.
+**/
+
+var addItem = function(item){
+	var index = itemBank.length;
+
+	checkBankSize(index + 1);
+	item.index = index;
+	itemBank.push(item);
+
+	bankDifficulty = grow(bankDifficulty, index + 1);
+	bankDifficulty[index] = item.difficulty;
+
+	bankWords = Math.ceil((index + 1) / 32);
+	retiredBitmap = grow(retiredBitmap, bankWords);
+	indexCharacteristics(item);
+
+	for (var model in bankTables) appendParameters(bankTables[model], item, model);
+
+	// The new item has the highest position, so it goes after every item of
+	// the same difficulty.
+	var place = lowerBound(item.difficulty, index);
+	bankOrder = grow(bankOrder, bankOrderLength + 1);
+	bankOrder.copyWithin(place + 1, place, bankOrderLength);
+	bankOrder[place] = index;
+	bankOrderLength++;
+}
+
+/**
+@retireItem
+@param item
+
+Takes an item out of selection. It keeps its bank position (and its entries
+in the frozen tables) so logs and checkpoints that refer to it stay valid;
+it is only removed from the difficulty order and marked item.retired.
+**/
+
+var retireItem = function(item){
+	var place = lowerBound(item.difficulty, item.index);
+	if (place >= bankOrderLength || bankOrder[place] != item.index) return;
+
+	bankOrder.copyWithin(place, place + 1, bankOrderLength);
+	bankOrderLength--;
+	item.retired = true;
+	retiredBitmap[item.index >>> 5] |= 1 << (item.index & 31);
+}
+
+var bankTable = function(model){
+	// Frozen again when setDifficultyScale changed the scale since
+	if (!bankTables[model] || bankTables[model].scale != itemResponse.difficultyScaleGeneration()){
+		bankTables[model] = freezeBank(model);
+	}
+	return bankTables[model];
+}
 
+useItemBank(itemBank);
 
 
 /**
@@ -166,11 +425,73 @@ Json
 {
 	question: "String",
 	difficulty: Integer,
+	index: Integer, (position in itemBank)
 }
 
 **/
 
 
+/**
+@registerAlgorithm
+@param algorithm
+
+Hooks an algorithm (response logger, exposure counter, ...) into the test.
+An algorithm is an object with any of these methods:
+	initialize(candidate)                   - when a new candidate starts the test
+	filter(candidate, mask, words)          - clear the bits of ineligible items
+	                                          in the bank length bitmap mask
+	select(candidate, D, mask)              - returns the next item in place of
+	                                          selectItem (last registered wins),
+	                                          mask is the filtered bitmap or null
+	approve(candidate, item)                - return false to pass over the item
+	                                          selectItem picked (exposure control)
+	administer(candidate, item)             - returns the response in place of
+	                                          prompting the user
+	administered(candidate, item, score, D) - after each response is scored,
+	                                          D is the updated ability estimate
+	stop(candidate)                         - return true to end the test before
+	                                          its full length (stopping rules)
+	bankSize(items)                         - the bank is about to hold items
+	                                          positions (useItemBank, addItem)
+	                                          or a test starts on it; throw to
+	                                          refuse, e.g. a counter without
+	                                          room for them
+**/
+
+var registerAlgorithm = function(algorithm){
+	algorithms.push(algorithm);
+}
+
+var unregisterAlgorithm = function(algorithm){
+	var a = algorithms.indexOf(algorithm);
+	if (a >= 0) algorithms.splice(a, 1);
+}
+
+/**
+@findAlgorithm
+@param name
+
+The registered algorithm with this name, or null. Lets modules share one
+instance of an algorithm (see stopping.js informationAccumulator) for as
+long as it stays registered.
+**/
+
+var findAlgorithm = function(name){
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].name === name) return algorithms[a];
+	}
+	return null;
+}
+
+var setVerbose = function(flag){
+	verbose = flag;
+}
+
+var setTestLength = function(length){
+	testLength = length;
+}
+
+
 
 
 /**
@@ -185,6 +506,90 @@ Set the curCandidate's ability to that average.
 **/
 
 
+/**
+@log
+Prints its arguments like console.log when verbose is on.
+**/
+
+var log = function(){
+	if (verbose) console.log.apply(console, arguments);
+}
+
+
+/**
+@thetaSlot
+@param name
+
+Registers a named ability value kept on each candidate (e.g. "estimate") and
+returns its slot. Algorithms call this once when they are created and then
+read candidateThetas(candidate)[slot] directly inside the test loop;
+getTheta/setTheta are the by-name wrappers.
+**/
+
+var thetaSlots = Object.create(null), // Name -> slot, no prototype so any name is a key
+	thetaSlotCount = 0;
+
+var thetaSlot = function(name){
+	if (!(name in thetaSlots)) thetaSlots[name] = thetaSlotCount++;
+	return thetaSlots[name];
+}
+
+// The ability estimate D after each response, updated in begin
+var ESTIMATE_SLOT = thetaSlot("estimate");
+
+/**
+@candidateThetas
+@param candidate
+
+Dense Float64Array of the candidate's ability values, one per registered slot.
+Grown when slots were registered after the candidate got its array.
+**/
+
+var candidateThetas = function(candidate){
+	var thetas = candidate.thetas;
+	if (!thetas || thetas.length < thetaSlotCount){
+		var grown = new Float64Array(thetaSlotCount).fill(NaN);
+		if (thetas) grown.set(thetas);
+		thetas = candidate.thetas = grown;
+	}
+	return thetas;
+}
+
+var getTheta = function(candidate, name){
+	return candidateThetas(candidate)[thetaSlot(name)];
+}
+
+var setTheta = function(candidate, name, value){
+	candidateThetas(candidate)[thetaSlot(name)] = value;
+}
+
+
+/**
+@acquireCandidate
+@param name, ability, examinee (optional recorded examinee id)
+
+Hands out a candidate object from the pool, reset in place, so long
+simulations and replays do not build a new object for every examinee. Give it
+back with releaseCandidate once the test result has been read.
+**/
+
+var candidatePool = [];
+
+var acquireCandidate = function(name, ability, examinee){
+	var candidate = candidatePool.pop() || { name: "", ability: 0, examinee: undefined, thetas: null };
+
+	candidate.name = name;
+	candidate.ability = ability;
+	candidate.examinee = examinee;
+	candidateThetas(candidate).fill(NaN);
+	return candidate;
+}
+
+var releaseCandidate = function(candidate){
+	candidatePool.push(candidate);
+}
+
+
 /**
 Request next candidate
 -----
@@ -192,10 +597,12 @@ Initialize variables of that user to 0
 From test bank, find next item closest to the difficulty D.
 
 Set user's D to the actual D value of that item.
-@param User
+@param User (optional, defaults to the first candidate in candidateBank)
+Returns the result of the test, see begin.
 **/
 
-var newCandidate = function(){
+var newCandidate = function(nextCandidate){
+	checkBankSize(itemBank.length);
 
 	//Resetting
 
@@ -203,41 +610,53 @@ var newCandidate = function(){
 	L = 0;
 	H = 0;
 	R = 0;	
+	administeredItems.length = 0; // Reset in place, no new arrays per candidate
+	administeredScores.length = 0;
+	testArena.reset();
 
-	var nextCandidate = candidateBank[0];
+	nextCandidate = nextCandidate || candidateBank[0];
 	
 	D = nextCandidate.ability
 	testStandard = 5; // Initializing testStandard
 	tLength = testLength;
 
-	begin(nextCandidate);
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].initialize) algorithms[a].initialize(nextCandidate);
+	}
+
+	return begin(nextCandidate);
 }
 
 var begin = function(nextCandidate){
 	// St 1) Prompt for next candidate 
 
 	// St 2) Find closest difficulty
-	var closestItem = findItemInBank(D);
+	var closestItem = chooseItem(D, nextCandidate);
+	if (!closestItem){
+		log("No items left in the bank");
+		tLength = 0;
+		return nextStep(nextCandidate);
+	}
 	// St 3) Set D at the actual calibration of that item
 	D = closestItem.difficulty;
-	console.log(D);
+	log(D);
 
 	// St 4-5) Administer the Item. Continue steps in here
-	var response = administerItem(closestItem);
-	// console.log(response);
+	var response = administerItem(closestItem, nextCandidate);
+	// log(response);
 
 	// St 6) Score this response. 1 = right, 0 - wrong.
 	
 	//======== ADDING IN IRT PROBABILITY
 
 	var IRTProbability = raschModel(D, nextCandidate.ability);
-	console.log("item difficulty" + D + "candidate ability " + nextCandidate.ability);
-	console.log("Probability " + IRTProbability);
+	log("item difficulty" + D + "candidate ability " + nextCandidate.ability);
+	log("Probability " + IRTProbability);
 
 	//======== ADDING IN IRT PROBABILITY
 	
 	var score = scoreResponse(response, closestItem);
-	console.log(score);
+	log(score);
 
 	// St 7) Total items taken
 	L += 1;
@@ -248,30 +667,60 @@ var begin = function(nextCandidate){
 
 	// St 9) If response incorrect, D = D - 2/L
 	if (score == 0){
-		console.log(D + "\n Before");
+		log(D + "\n Before");
 		D = D - 2 / L;
-		console.log(D);
+		log(D);
 	}
 
 	// St 10-11) If response is correct, D = D + 2/L
 	if (score == 1){
-		console.log("Correct ");
+		log("Correct ");
 		D = D + 2/L;
 		R += 1; // Update right count
 	}
 
+	administeredItems.push(closestItem.index);
+	administeredScores.push(score);
+	candidateThetas(nextCandidate)[ESTIMATE_SLOT] = D;
+
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].administered){
+			algorithms[a].administered(nextCandidate, closestItem, score, D);
+		}
+	}
+
+	return nextStep(nextCandidate);
+};
+
+
+/**
+@nextStep
+@param nextCandidate
+
+Steps 12-16: either goes back for another item or scores the test. Split
+out of begin so a restored session (see restoreSession) can pick up where
+the checkpoint was taken.
+**/
+
+var nextStep = function(nextCandidate){
+	// A stopping rule can end the test before its full length
+	if (tLength > 0 && stopTest(nextCandidate)){
+		log("Stopping rule met");
+		tLength = 0;
+	}
+
 	// St 12) If not ready to decide to pass fail, repeat
 	if (tLength > 0){
-		console.log("Haven't finished testing yet");
+		log("Haven't finished testing yet");
 		tLength -= 1;
-		console.log(tLength + " more questions to go");
+		log(tLength + " more questions to go");
 
-		begin(nextCandidate);
+		return begin(nextCandidate);
 	}
 
 	// St 13) If ready, calcualte wrong answers 
 	if (tLength <= 0){
-		console.log("Ready to score pass or fail");
+		log("Ready to score pass or fail");
 
 		var W = L - R; //Caculate wrong answers
 		
@@ -293,26 +742,33 @@ var begin = function(nextCandidate){
 		// St 15) Estimate standard error of the mesaure
 		var standardError = (L/(R*W));
 
-		console.log(" Measure is " + measure  );
-		console.log(" StandardError is " + standardError );
+		log(" Measure is " + measure  );
+		log(" StandardError is " + standardError );
 
 		// St 16) Compare (measure) with pass/fail standard standardError. Assess
 
 		//Is the estimate standard error small enough to stop the test?
 
 		if ((measure - standardError) > testStandard){
-			console.log("Passed the testStandard");
+			log("Passed the testStandard");
 		}
 
 		else if ((measure + standardError) < testStandard){
-		 	console.log("Failed the testStandard");
+		 	log("Failed the testStandard");
 		}	
 
-		console.log("Final ability level of the child is " + measure);
+		log("Final ability level of the child is " + measure);
+
+		return {
+			measure: measure,
+			standardError: standardError,
+			itemsTaken: L,
+			rightAnswers: R
+		};
 		//Check for standard Error.
 
 		// else if ((testStandard - standardError) < measure < (testStandard + standardError)){
-		//	console.log("Repeat Step 2");
+		//	log("Repeat Step 2");
 		// }
 	
 		
@@ -324,27 +780,333 @@ var begin = function(nextCandidate){
 
 
 
+/**
+@serializeSession
+@param candidate
+
+Checkpoints the running test of candidate into a compact Buffer so it can be
+resumed in another process with resumeSession. Items are stored as bank
+indices. Registered algorithms that keep per candidate state add it through
+a saveState(candidate) hook returning a Buffer; it is handed back to the
+algorithm with the same name through restoreState(candidate, state).
+
+Layout (little endian):
+	"CATS", version uint16, flags uint16 (1 = candidate.examinee set)
+	D, H, testStandard, ability     float64
+	L, R, tLength, item count       uint32
+	examinee                        uint32
+	name                            uint16 length + utf8
+	items                           uint32 per item
+	scores                          uint8 per item
+	theta count                     uint16
+	per theta slot: name uint16 length + utf8, value float64
+	algorithm count                 uint16
+	per algorithm: name uint16 length + utf8, state uint32 length + bytes
+**/
+
+var SESSION_VERSION = 2;
+
+var serializeSession = function(candidate){
+	var name = Buffer.from(String(candidate.name), 'utf8'),
+		count = administeredItems.length,
+		thetas = candidateThetas(candidate),
+		thetaNames = [],
+		states = [];
+
+	for (var key in thetaSlots){
+		thetaNames[thetaSlots[key]] = Buffer.from(key, 'utf8');
+	}
+
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].saveState){
+			states.push({
+				name: Buffer.from(algorithms[a].name, 'utf8'),
+				state: algorithms[a].saveState(candidate)
+			});
+		}
+	}
+
+	var size = 8 + 32 + 16 + 4 + 2 + name.length + 5 * count + 2 + 2;
+	thetaNames.forEach(function(key){ size += 10 + key.length; });
+	states.forEach(function(s){ size += 6 + s.name.length + s.state.length; });
+
+	var buf = Buffer.alloc(size),
+		offset = 0;
+
+	buf.write("CATS", 0, 'ascii');
+	buf.writeUInt16LE(SESSION_VERSION, 4);
+	buf.writeUInt16LE(candidate.examinee == null ? 0 : 1, 6);
+	buf.writeDoubleLE(D, 8);
+	buf.writeDoubleLE(H, 16);
+	buf.writeDoubleLE(testStandard, 24);
+	buf.writeDoubleLE(candidate.ability, 32);
+	buf.writeUInt32LE(L, 40);
+	buf.writeUInt32LE(R, 44);
+	buf.writeUInt32LE(tLength, 48);
+	buf.writeUInt32LE(count, 52);
+	buf.writeUInt32LE(candidate.examinee == null ? 0 : candidate.examinee, 56);
+	buf.writeUInt16LE(name.length, 60);
+	offset = 62 + name.copy(buf, 62);
+
+	for (var i = 0; i < count; i++, offset += 4){
+		buf.writeUInt32LE(administeredItems[i], offset);
+	}
+	for (var i = 0; i < count; i++, offset++){
+		buf.writeUInt8(administeredScores[i], offset);
+	}
+
+	buf.writeUInt16LE(thetaNames.length, offset);
+	offset += 2;
+	thetaNames.forEach(function(key, slot){
+		buf.writeUInt16LE(key.length, offset);
+		offset += 2 + key.copy(buf, offset + 2);
+		buf.writeDoubleLE(thetas[slot], offset);
+		offset += 8;
+	});
+
+	buf.writeUInt16LE(states.length, offset);
+	offset += 2;
+	states.forEach(function(s){
+		buf.writeUInt16LE(s.name.length, offset);
+		offset += 2 + s.name.copy(buf, offset + 2);
+		buf.writeUInt32LE(s.state.length, offset);
+		offset += 4 + s.state.copy(buf, offset + 4);
+	});
+
+	return buf;
+}
+
+
+/**
+@restoreSession
+@param buf (from serializeSession)
+
+Puts the test back into the checkpointed state and returns the candidate.
+Algorithm state is handed to the registered algorithm of the same name.
+**/
+
+var restoreSession = function(buf){
+	if (buf.toString('ascii', 0, 4) != "CATS" || buf.readUInt16LE(4) != SESSION_VERSION){
+		throw new Error("Not a session checkpoint");
+	}
+	checkBankSize(itemBank.length);
+
+	var candidate = {
+		name: buf.toString('utf8', 62, 62 + buf.readUInt16LE(60)),
+		ability: buf.readDoubleLE(32)
+	};
+	if (buf.readUInt16LE(6) & 1) candidate.examinee = buf.readUInt32LE(56);
+
+	D = buf.readDoubleLE(8);
+	H = buf.readDoubleLE(16);
+	testStandard = buf.readDoubleLE(24);
+	L = buf.readUInt32LE(40);
+	R = buf.readUInt32LE(44);
+	tLength = buf.readUInt32LE(48);
+
+	var count = buf.readUInt32LE(52),
+		offset = 62 + buf.readUInt16LE(60);
+
+	administeredItems = new Array(count);
+	administeredScores = new Array(count);
+	for (var i = 0; i < count; i++, offset += 4){
+		administeredItems[i] = buf.readUInt32LE(offset);
+	}
+	for (var i = 0; i < count; i++, offset++){
+		administeredScores[i] = buf.readUInt8(offset);
+	}
+
+	var thetaCount = buf.readUInt16LE(offset);
+	offset += 2;
+	for (var t = 0; t < thetaCount; t++){
+		var keyLength = buf.readUInt16LE(offset),
+			key = buf.toString('utf8', offset + 2, offset + 2 + keyLength);
+		setTheta(candidate, key, buf.readDoubleLE(offset + 2 + keyLength));
+		offset += 10 + keyLength;
+	}
+
+	var stateCount = buf.readUInt16LE(offset);
+	offset += 2;
+	for (var s = 0; s < stateCount; s++){
+		var nameLength = buf.readUInt16LE(offset),
+			algName = buf.toString('utf8', offset + 2, offset + 2 + nameLength);
+		offset += 2 + nameLength;
+		var stateLength = buf.readUInt32LE(offset),
+			state = buf.subarray(offset + 4, offset + 4 + stateLength);
+		offset += 4 + stateLength;
+
+		for (var a = 0; a < algorithms.length; a++){
+			if (algorithms[a].name == algName && algorithms[a].restoreState){
+				algorithms[a].restoreState(candidate, state);
+			}
+		}
+	}
+
+	return candidate;
+}
+
+
+/**
+@resumeSession
+@param buf (from serializeSession)
+
+Restores a checkpoint taken after an item was scored (e.g. from an
+administered hook) and carries on with the test. Returns the test result.
+**/
+
+var resumeSession = function(buf){
+	return nextStep(restoreSession(buf));
+}
+
+
+
 /**
 @findItemInBank
 @param D = target difficulty
 Returns the item with the closest difficulty as the passed in parameter D.
+Binary search over the difficulty order built by useItemBank. Ties go to the
+item earliest in the bank.
 **/
 
 var findItemInBank = function(D){
-	minVal = 999;
-	minItem = "";
-	// console.log(" the D value is " + D);
-
-	for (item in itemBank){
-		var difference = Math.abs(D - itemBank[item].difficulty)
-		// console.log("The difference is " + difference);
-		if (difference < minVal){
-			minVal = difference;
-			minItem = itemBank[item];
+	// log(" the D value is " + D);
+	var above = lowerBound(D);
+
+	if (bankOrderLength == 0) return undefined;
+	if (above == 0) return bankItem(bankOrder[0]);
+
+	// First (lowest position) item of the closest difficulty below D
+	var below = lowerBound(bankDifficulty[bankOrder[above - 1]]);
+	if (above == bankOrderLength) return bankItem(bankOrder[below]);
+
+	var up = bankOrder[above],
+		down = bankOrder[below],
+		upDifference = bankDifficulty[up] - D,
+		downDifference = D - bankDifficulty[down];
+	// log("The difference is " + upDifference + " / " + downDifference);
+
+	if (upDifference < downDifference) return bankItem(up);
+	if (downDifference < upDifference) return bankItem(down);
+	return bankItem(Math.min(up, down));
+}
+
+/**
+@selectItem
+@param D = target difficulty, candidate
+Like findItemInBank, but walks outward from D in the difficulty order and
+returns the closest item the candidate has not been given yet that passes
+every registered filter and approve hook. Returns undefined when no item is
+left.
+**/
+
+var tiedItems = [];
+
+var selectItem = function(D, candidate){
+	var up = lowerBound(D),
+		down = up - 1,
+		eligible = filterItems(candidate);
+
+	while (up < bankOrderLength || down >= 0){
+		var upDifference = up < bankOrderLength ? bankDifficulty[bankOrder[up]] - D : Infinity,
+			downDifference = down >= 0 ? D - bankDifficulty[bankOrder[down]] : Infinity,
+			difference = Math.min(upDifference, downDifference);
+
+		// Every item at this distance, tried from the earliest in the bank
+		tiedItems.length = 0;
+		while (up < bankOrderLength && bankDifficulty[bankOrder[up]] - D == difference){
+			tiedItems.push(bankOrder[up++]);
+		}
+		while (down >= 0 && D - bankDifficulty[bankOrder[down]] == difference){
+			tiedItems.push(bankOrder[down--]);
+		}
+		if (tiedItems.length > 1) tiedItems.sort(function(x, y){ return x - y; });
+
+		for (var t = 0; t < tiedItems.length; t++){
+			var index = tiedItems[t];
+			if (eligible && !(eligible[index >>> 5] & (1 << (index & 31)))) continue;
+			if (administeredItems.indexOf(index) < 0 && approveItem(candidate, bankItem(index))){
+				return bankItem(index);
+			}
 		}
 	}
 
-	return minItem
+	return undefined;
+}
+
+/**
+@chooseItem
+@param D, candidate
+Asks the last registered select hook (e.g. the shadow test) for the next item,
+falling back to selectItem when no algorithm selects.
+**/
+
+var chooseItem = function(D, candidate){
+	for (var a = algorithms.length - 1; a >= 0; a--){
+		if (algorithms[a].select){
+			return algorithms[a].select(candidate, D, filterItems(candidate));
+		}
+	}
+	return selectItem(D, candidate);
+}
+
+/**
+@filterItems
+@param candidate
+Runs the filter hooks over a bank length eligibility bitmap that starts with
+every item set. Returns null when no algorithm filters.
+**/
+
+var eligibleMask = new Uint32Array(0);
+
+var filterItems = function(candidate){
+	var mask = null;
+
+	for (var a = 0; a < algorithms.length; a++){
+		if (!algorithms[a].filter) continue;
+		if (!mask){
+			mask = eligibleMask = grow(eligibleMask, bankWords);
+			mask.fill(0xffffffff, 0, bankWords);
+		}
+		algorithms[a].filter(candidate, mask, bankWords);
+	}
+
+	return mask;
+}
+
+var stopTest = function(candidate){
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].stop && algorithms[a].stop(candidate)) return true;
+	}
+	return false;
+}
+
+var approveItem = function(candidate, item){
+	for (var a = 0; a < algorithms.length; a++){
+		if (algorithms[a].approve && !algorithms[a].approve(candidate, item)) return false;
+	}
+	return true;
+}
+
+/**
+@lowerBound
+@param difficulty, position (optional)
+First place in the difficulty order whose item is at least as hard (or, with
+a position, equally hard and at least at that bank position).
+**/
+
+var lowerBound = function(difficulty, position){
+	var lo = 0,
+		hi = bankOrderLength;
+	if (position == null) position = -1;
+
+	while (lo < hi){
+		var mid = (lo + hi) >>> 1,
+			other = bankOrder[mid],
+			d = bankDifficulty[other];
+		if (d < difficulty || (d == difficulty && other < position)) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
 }
 
 /**
@@ -352,9 +1114,17 @@ var findItemInBank = function(D){
 @param item -> dictionary of question and difficulty
 
 Gives the user the question, recieves a response.
+If a registered algorithm has an administer hook (e.g. the replay
+administrator) the last one registered answers instead of the user.
 **/
 
-var administerItem = function(item){
+var administerItem = function(item, candidate){
+	for (var a = algorithms.length - 1; a >= 0; a--){
+		if (algorithms[a].administer){
+			return algorithms[a].administer(candidate, item);
+		}
+	}
+
 	var question = item.question;
 	return getUserPrompt(question); //Asynchronous call
 
@@ -368,8 +1138,9 @@ Prompts the user with the question. Synchronous version with readlineSync
 **/
 
 var getUserPrompt = function(question){
+	var readlineSync = require('readline-sync');
 	var answer = readlineSync.question(question + '\n' );
-	console.log("Your answer is: \n");
+	log("Your answer is: \n");
 	return answer;
 }
 
@@ -383,14 +1154,14 @@ Scores the response
 **/
 
 var scoreResponse = function(response, item){
-	console.log("Scoring response");
+	log("Scoring response");
 	if (response != item.answer){
-		console.log("WRONG");
+		log("WRONG");
 		return 0;
 	}
 
 	else {
-		console.log("Correct");
+		log("Correct");
 		return 1;
 	}
 	
@@ -400,91 +1171,72 @@ var scoreResponse = function(response, item){
 
 // IRT MODULE ===============================================================
 
-
-/*
-@raschModel
-@params itemDifficulty latentAbility
-
-Person parameter is latentAbility
-
-Item Response Theory Model for each item. One Parameter Model, Rasch. P(theta) is assessment of a learners probability of attaining a correct
-answer to this specific problem given an ability level. 
-
-Rasch Model IMplementation
-Equation => exp(theta - Bi) / 1 + exp(theta - Bi)
-
-References:
-Book Rasch Models
-
-
-*/
-	
-var raschModel = function(itemDifficulty, latentAbility){
-
-	//Scaling 
-	theta = scaleDifficulty(latentAbility);
-	b = scaleDifficulty(itemDifficulty);
-
-
-	result = ( Math.exp(theta - b) / (1 + Math.exp(theta - b)) ) 
-	return result;
-}
+// The models live in itemResponse.js; these are the names cat.js uses.
+
+var raschModel = itemResponse.raschModel,
+	logOddsModel = itemResponse.logOddsModel,
+	scaleDifficulty = itemResponse.scaleDifficulty;
+
+
+
+module.exports = {
+	useItemBank: useItemBank,
+	bankTable: bankTable,
+	characteristicBitmap: characteristicBitmap,
+	bankWords: getBankWords,
+	bankItem: bankItem,
+	isRetired: isRetired,
+	addItem: addItem,
+	retireItem: retireItem,
+	registerAlgorithm: registerAlgorithm,
+	unregisterAlgorithm: unregisterAlgorithm,
+	findAlgorithm: findAlgorithm,
+	setVerbose: setVerbose,
+	setTestLength: setTestLength,
+	scratch: scratch,
+	newCandidate: newCandidate,
+	acquireCandidate: acquireCandidate,
+	thetaSlot: thetaSlot,
+	candidateThetas: candidateThetas,
+	getTheta: getTheta,
+	setTheta: setTheta,
+	releaseCandidate: releaseCandidate,
+	serializeSession: serializeSession,
+	restoreSession: restoreSession,
+	resumeSession: resumeSession,
+	findItemInBank: findItemInBank,
+	selectItem: selectItem,
+	approveItem: approveItem,
+	administeredItems: getAdministeredItems,
+	scoreResponse: scoreResponse
+};
 
 
+// ======================TEST CASES========================= //
 
-/*
-@logOddsModel
-@param raschModel
+// newCandidate();
 
-Returns logit units to estimate learner probability
-Equation: e ^ ( probability of success / probability of failure) => e ^ (raschModel) / (1 - raschModel)
 
-*/
+if (require.main === module){
 
-var logOddsModel = function(raschProbability){
-	logit = Math.exp( raschProbability / (1 - raschProbability));
+	console.log("Rasch model testing ~~~~ ");
+	console.log(raschModel(70, 25));
+	console.log(raschModel(92,98));
+	console.log(raschModel(24,62));
 
-	return logit;
-}
 
+	console.log("scaled difficulty " + scaleDifficulty(80));
 
-/*
-@scaleDifficulty
-@params value to convert, range1 [...], range2 [.....]
+	console.log('Rasch model of 72 and 70 converted probability ' +  raschModel(scaleDifficulty(80), scaleDifficulty(61)));
 
-Scales item difficulty from 1-100 to -3 to 3 for raschModel.
+	console.log("Testing logits ~~~~ ");
 
-*/
+	console.log(logOddsModel(raschModel(80, 61)) + " logits ");
 
-function scaleDifficulty( value) { 
-	r1 = [1, 100];
-	r2 = [-3, 3];
-    return ( value - r1[ 0 ] ) * ( r2[ 1 ] - r2[ 0 ] ) / ( r1[ 1 ] - r1[ 0 ] ) + r2[ 0 ];
 }
 
 
 
-// ======================TEST CASES========================= //
-
-// newCandidate();
-
-
-console.log("Rasch model testing ~~~~ ");
-console.log(raschModel(70, 25));
-console.log(raschModel(92,98));
-console.log(raschModel(24,62));
-
-
-console.log("scaled difficulty " + scaleDifficulty(80));
-
-console.log('Rasch model of 72 and 70 converted probability ' +  raschModel(scaleDifficulty(80), scaleDifficulty(61)));
-
-console.log("Testing logits ~~~~ ");
-
-console.log(logOddsModel(raschModel(80, 61)) + " logits ");
-
-
-
 
 
 // findITEMINBANK Testing
@@ -0,0 +1,89 @@
+/*
+Content
+----------------
+content.js
+
+Content constraints for cat.js. Items list their content areas in
+item.characteristics ("algebra", "word problem", ...). When the bank is
+frozen (useItemBank) cat.js builds one bank length bitmap per characteristic,
+so a content constraint is a handful of AND / OR / NOT passes over 32 bit
+words rather than a walk over the items.
+
+A constraint is either
+	"name"                 items with that characteristic
+	{ all: [c, c, ...] }   items meeting every constraint
+	{ any: [c, c, ...] }   items meeting at least one
+	{ not: c }             items not meeting it
+or a function(candidate) returning one, for blueprints that change as the
+test goes on.
+
+*/
+
+
+/*
+@createContentFilter
+@params cat (the cat.js module), constraint
+
+Algorithm with a filter hook that clears every item not meeting the
+constraint from the eligibility mask.
+
+*/
+
+var createContentFilter = function(cat, constraint){
+	var temps = [];
+
+	// Scratch bitmap for a nesting depth, reused from one selection to the next
+	var temp = function(depth, words){
+		if (!temps[depth] || temps[depth].length < words){
+			temps[depth] = new Uint32Array(Math.max(words, 2 * (temps[depth] ? temps[depth].length : 0)));
+		}
+		return temps[depth];
+	};
+
+	// Writes the items meeting c into out[0 .. words)
+	var evaluate = function(c, out, words, depth){
+		var w;
+
+		if (typeof c == "string"){
+			var bitmap = cat.characteristicBitmap(c);
+			for (w = 0; w < words; w++) out[w] = w < bitmap.length ? bitmap[w] : 0;
+			return;
+		}
+
+		if (c.not){
+			evaluate(c.not, out, words, depth + 1);
+			for (w = 0; w < words; w++) out[w] = ~out[w];
+			return;
+		}
+
+		var parts = c.all || c.any,
+			isAll = !!c.all;
+		if (!parts) throw new Error("Bad content constraint " + JSON.stringify(c));
+
+		out.fill(isAll ? 0xffffffff : 0, 0, words);
+		var part = temp(depth, words);
+		for (var p = 0; p < parts.length; p++){
+			evaluate(parts[p], part, words, depth + 1);
+			if (isAll) for (w = 0; w < words; w++) out[w] &= part[w];
+			else for (w = 0; w < words; w++) out[w] |= part[w];
+		}
+	};
+
+	return {
+		name: "contentFilter",
+
+		filter: function(candidate, mask, words){
+			var c = typeof constraint == "function" ? constraint(candidate) : constraint;
+			if (c == null) return;
+
+			var result = temp(0, words);
+			evaluate(c, result, words, 1);
+			for (var w = 0; w < words; w++) mask[w] &= result[w];
+		}
+	};
+}
+
+
+module.exports = {
+	createContentFilter: createContentFilter
+};
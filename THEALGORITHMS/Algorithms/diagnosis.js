@@ -0,0 +1,541 @@
+/*
+Diagnosis
+----------------
+diagnosis.js
+
+Cognitive diagnosis models. Instead of one ability, the examinee has an
+attribute pattern: which of K skills they have mastered, kept as an integer
+bitmask (bit k set = attribute k mastered). Each item lists the attributes
+it needs in item.attributes (its row of the Q-matrix).
+
+	DINA   P = 1 - item.slip   when every needed attribute is mastered
+	       P = item.guess      otherwise
+	NIDA   P = product over the needed attributes k of
+	       (1 - slip[k]) if k is mastered, guess[k] if not
+	       (slip and guess belong to the attributes, not the items)
+
+Estimation and item selection evaluate P for every pattern, 2^K of them,
+over and over. patternTable evaluates each item once per pattern up front
+into a row indexed by the pattern, so those loops become plain reads.
+
+*/
+
+
+/*
+@attributeMask
+@params item
+
+Bitmask of the attributes the item needs, read from item.attributes (array
+of attribute numbers) and kept on item.attributeMask.
+
+*/
+
+var attributeMask = function(item){
+	if (item.attributeMask == null){
+		var mask = 0;
+		(item.attributes || []).forEach(function(k){
+			mask |= 1 << k;
+		});
+		item.attributeMask = mask >>> 0;
+	}
+	return item.attributeMask;
+}
+
+/*
+@dinaModel
+@params item, pattern
+
+P(right | pattern) under DINA.
+
+*/
+
+var dinaModel = function(item, pattern){
+	var needed = attributeMask(item);
+	return (pattern & needed) == needed ? 1 - item.slip : item.guess;
+}
+
+/*
+@nidaModel
+@params item, pattern, slip, guess (per attribute arrays)
+
+P(right | pattern) under NIDA.
+
+*/
+
+var nidaModel = function(item, pattern, slip, guess){
+	var needed = attributeMask(item),
+		P = 1;
+	for (var k = 0; needed >>> k; k++){
+		if (!((needed >>> k) & 1)) continue;
+		P *= (pattern >>> k) & 1 ? 1 - slip[k] : guess[k];
+	}
+	return P;
+}
+
+
+/*
+@patternTable
+@params items, options
+	attributes   K, number of attributes, at most 24
+	model        "dina" (default) or "nida"
+	slip, guess  per attribute arrays for "nida"
+	precision    "float64" (default) or "float32"
+
+Tabulates P(right | pattern) of every item for every pattern:
+table.rows[i * table.patterns + pattern]. Rows take items x 2^K numbers
+(8 MB per item at K = 20 in float64), so "float32" halves that for large K.
+
+Rows are filled without calling the model per pattern. For DINA a pattern
+is either a master of the item (all needed bits set) or not. For NIDA the
+row is built one attribute at a time, each pass doubling the patterns
+covered with one multiply per entry.
+
+*/
+
+var MAX_ATTRIBUTES = 24;
+
+var patternTable = function(items, options){
+	var K = options.attributes,
+		patterns = 1 << K,
+		model = options.model || "dina",
+		Column = options.precision == "float32" ? Float32Array : Float64Array;
+
+	if (K > MAX_ATTRIBUTES) throw new Error("At most " + MAX_ATTRIBUTES + " attributes");
+
+	var table = {
+		attributes: K,
+		patterns: patterns,
+		length: items.length,
+		precision: options.precision || "float64",
+		rows: new Column(items.length * patterns)
+	};
+
+	items.forEach(function(item, i){
+		var needed = attributeMask(item),
+			row = table.rows.subarray(i * patterns, (i + 1) * patterns),
+			pattern;
+
+		if (model == "dina"){
+			var master = 1 - item.slip,
+				other = item.guess;
+			for (pattern = 0; pattern < patterns; pattern++){
+				row[pattern] = (pattern & needed) == needed ? master : other;
+			}
+		}
+		else if (model == "nida"){
+			// Factor of attribute k for a pattern that does / does not master it
+			var has = new Float64Array(K),
+				lacks = new Float64Array(K);
+			for (var k = 0; k < K; k++){
+				has[k] = (needed >>> k) & 1 ? 1 - options.slip[k] : 1;
+				lacks[k] = (needed >>> k) & 1 ? options.guess[k] : 1;
+			}
+
+			// Patterns of the first k attributes are extended by attribute k
+			// in place, doubling the filled part of the row each time.
+			row[0] = 1;
+			for (k = 0; k < K; k++){
+				var half = 1 << k;
+				for (pattern = 0; pattern < half; pattern++){
+					row[pattern | half] = row[pattern] * has[k];
+					row[pattern] *= lacks[k];
+				}
+			}
+		}
+		else {
+			throw new Error("Unknown model " + model);
+		}
+	});
+
+	return table;
+}
+
+/*
+@patternRow
+@params table, index
+
+Row of the item at index: row[pattern] = P(right | pattern).
+
+*/
+
+var patternRow = function(table, index){
+	return table.rows.subarray(index * table.patterns, (index + 1) * table.patterns);
+}
+
+
+/*
+@estimatePattern
+@params responses, table, logPrior (optional, per pattern), out (optional)
+
+responses[i] is 1, 0 or null (not administered) for item i of the table.
+Returns { pattern, logPosterior } for the most likely pattern (MAP with the
+prior, maximum likelihood without). Reads one table row per response; the
+log posterior is summed in a scratch array reused from call to call.
+
+*/
+
+var patternScratch = new Float64Array(0);
+
+var estimatePattern = function(responses, table, logPrior, out){
+	var patterns = table.patterns;
+
+	if (patternScratch.length < patterns) patternScratch = new Float64Array(patterns);
+	var logPosterior = patternScratch.subarray(0, patterns);
+	if (logPrior) logPosterior.set(logPrior);
+	else logPosterior.fill(0);
+
+	for (var i = 0; i < responses.length; i++){
+		if (responses[i] == null) continue;
+		var row = patternRow(table, i),
+			right = responses[i] == 1;
+		for (var pattern = 0; pattern < patterns; pattern++){
+			logPosterior[pattern] += Math.log(right ? row[pattern] : 1 - row[pattern]);
+		}
+	}
+
+	var best = 0;
+	for (var pattern = 1; pattern < patterns; pattern++){
+		if (logPosterior[pattern] > logPosterior[best]) best = pattern;
+	}
+
+	out = out || {};
+	out.pattern = best;
+	out.logPosterior = logPosterior[best];
+	return out;
+}
+
+
+/*
+@patternLogTables
+@params table (from patternTable), criterion ("pwkl" or "shannon")
+
+Tables the selection criteria read alongside table.rows, one value per item
+and pattern, computed once: log P and log(1 - P) for "pwkl", P log P and
+(1 - P) log(1 - P) for "shannon".
+
+*/
+
+var patternLogTables = function(table, criterion){
+	var n = table.rows.length,
+		first = new Float64Array(n),
+		second = new Float64Array(n);
+
+	for (var e = 0; e < n; e++){
+		var P = table.rows[e],
+			Q = 1 - P;
+		if (criterion == "pwkl"){
+			first[e] = Math.log(P);
+			second[e] = Math.log(Q);
+		}
+		else {
+			first[e] = P > 0 ? P * Math.log(P) : 0;
+			second[e] = Q > 0 ? Q * Math.log(Q) : 0;
+		}
+	}
+	return { first: first, second: second };
+}
+
+
+/*
+@createPatternSelector
+@params cat (the cat.js module), table (patternTable over the bank, in bank
+        order), options
+	criterion   "pwkl" (posterior weighted KL, default) or "shannon"
+	            (smallest expected posterior entropy)
+	logPrior    log prior per pattern, default uniform
+
+Cognitive diagnostic item selection with a select hook. The posterior over
+the 2^K patterns is kept per examinee and updated once per response, by one
+table row. Scoring a candidate item is then a few dot products of that
+posterior with the item's rows, instead of recomputing the likelihood of
+every pattern from all items given so far:
+
+	pwkl      sum over patterns of posterior * KL(P(. | estimate) || P(. | pattern))
+	          = p log p + q log q - p (log P . posterior) - q (log(1 - P) . posterior)
+	          with p = 1 - q = P(right | estimate), the largest is picked
+	shannon   expected entropy of the posterior after the item
+
+selector.posterior is the posterior and selector.pattern the most likely
+pattern (the estimate).
+
+*/
+
+var createPatternSelector = function(cat, table, options){
+	options = options || {};
+	var criterion = options.criterion || "pwkl",
+		patterns = table.patterns,
+		logs = patternLogTables(table, criterion),
+		posterior = new Float64Array(patterns),
+		weighted = new Float64Array(patterns), // posterior * log posterior, for shannon
+		weightedTotal = 0,
+		given = new Uint8Array(table.length),
+		scores = new Float64Array(table.length),
+		order = new Uint32Array(table.length);
+
+	if (criterion != "pwkl" && criterion != "shannon"){
+		throw new Error("Unknown criterion " + criterion);
+	}
+
+	var findPattern = function(){
+		var best = 0;
+		for (var pattern = 1; pattern < patterns; pattern++){
+			if (posterior[pattern] > posterior[best]) best = pattern;
+		}
+		selector.pattern = best;
+	};
+
+	// Lower is better for both criteria
+	var score = function(index){
+		var offset = index * patterns,
+			rows = table.rows,
+			first = logs.first,
+			second = logs.second,
+			pattern;
+
+		if (criterion == "pwkl"){
+			var p = rows[offset + selector.pattern],
+				q = 1 - p,
+				right = 0,
+				wrong = 0;
+			for (pattern = 0; pattern < patterns; pattern++){
+				right += posterior[pattern] * first[offset + pattern];
+				wrong += posterior[pattern] * second[offset + pattern];
+			}
+			return -((p > 0 ? p * Math.log(p) : 0) + (q > 0 ? q * Math.log(q) : 0) - p * right - q * wrong);
+		}
+
+		var s1 = 0, a1 = 0, b1 = 0, b0 = 0;
+		for (pattern = 0; pattern < patterns; pattern++){
+			var P = rows[offset + pattern];
+			s1 += posterior[pattern] * P;
+			a1 += weighted[pattern] * P;
+			b1 += posterior[pattern] * first[offset + pattern];
+			b0 += posterior[pattern] * second[offset + pattern];
+		}
+		var s0 = 1 - s1;
+		return -(a1 + b1) + (s1 > 0 ? s1 * Math.log(s1) : 0) -
+			(weightedTotal - a1 + b0) + (s0 > 0 ? s0 * Math.log(s0) : 0);
+	};
+
+	var selector = {
+		name: "patternSelector",
+		posterior: posterior,
+		pattern: 0,
+
+		initialize: function(candidate){
+			if (options.logPrior){
+				var total = 0;
+				for (var pattern = 0; pattern < patterns; pattern++){
+					total += posterior[pattern] = Math.exp(options.logPrior[pattern]);
+				}
+				for (pattern = 0; pattern < patterns; pattern++) posterior[pattern] /= total;
+			}
+			else {
+				posterior.fill(1 / patterns);
+			}
+			findPattern();
+		},
+
+		select: function(candidate, D, mask){
+			var administered = cat.administeredItems(),
+				count = 0,
+				i;
+
+			for (i = 0; i < administered.length; i++) given[administered[i]] = 1;
+			if (criterion == "shannon"){
+				weightedTotal = 0;
+				for (var pattern = 0; pattern < patterns; pattern++){
+					weighted[pattern] = posterior[pattern] > 0 ? posterior[pattern] * Math.log(posterior[pattern]) : 0;
+					weightedTotal += weighted[pattern];
+				}
+			}
+
+			for (i = 0; i < table.length; i++){
+				if (given[i] || (mask && !(mask[i >>> 5] & (1 << (i & 31))))) continue;
+				if (cat.isRetired(i)) continue;
+				scores[i] = score(i);
+				order[count++] = i;
+			}
+			for (i = 0; i < administered.length; i++) given[administered[i]] = 0;
+
+			// Approve hooks have side effects (exposure counts), so they only
+			// see items in score order until one is accepted.
+			var ranked = order.subarray(0, count).sort(function(x, y){ return scores[x] - scores[y]; });
+			for (i = 0; i < count; i++){
+				var item = cat.bankItem(ranked[i]);
+				if (cat.approveItem(candidate, item)) return item;
+			}
+			return undefined;
+		},
+
+		administered: function(candidate, item, score, D){
+			var offset = item.index * patterns,
+				rows = table.rows,
+				total = 0;
+			for (var pattern = 0; pattern < patterns; pattern++){
+				var P = rows[offset + pattern];
+				total += posterior[pattern] *= score == 1 ? P : 1 - P;
+			}
+			for (pattern = 0; pattern < patterns; pattern++) posterior[pattern] /= total;
+			findPattern();
+		},
+
+		saveState: function(candidate){
+			return Buffer.from(posterior.buffer, posterior.byteOffset, posterior.byteLength);
+		},
+
+		restoreState: function(candidate, state){
+			for (var pattern = 0; pattern < patterns; pattern++){
+				posterior[pattern] = state.readDoubleLE(8 * pattern);
+			}
+			findPattern();
+		}
+	};
+
+	return selector;
+}
+
+
+/*
+@createClassRates
+@params options
+	attributes   K, at most 24 (required)
+	shards       number of threads that will record, default 1
+	shard        shard this thread records into, default 0
+
+Classification accuracy of a diagnostic test, kept in dense Int32 arrays
+indexed by the pattern integer, so recording an examinee is a few array
+increments with no lookup or allocation. Like the exposure counters
+(exposure.js) the counts live in a SharedArrayBuffer with one shard per
+thread; hand rates.buffer to the workers and open it with openClassRates.
+Each shard is 2 * 2^K + K + 1 slots (128 MB at K = 24).
+
+*/
+
+var createClassRates = function(options){
+	var shards = options.shards || 1,
+		buffer = new SharedArrayBuffer(shards * classRatesStride(options.attributes) * 4);
+
+	return openClassRates(buffer, options.attributes, shards, options.shard || 0);
+}
+
+var classRatesStride = function(K){
+	if (K > MAX_ATTRIBUTES) throw new Error("At most " + MAX_ATTRIBUTES + " attributes");
+	return 2 * (1 << K) + K + 1;
+}
+
+
+/*
+@openClassRates
+@params buffer, attributes, shards, shard
+
+Class rates over an existing buffer, for a thread recording into shard.
+A shard holds the examinees with each true pattern, the examinees with
+each true pattern classified exactly, the examinees right on each
+attribute and the number of examinees.
+
+	rates.record(truePattern, estimate)   one classified examinee
+	rates.examinees(pattern)              examinees with that true pattern,
+	                                      all examinees without one
+	rates.rate(pattern)                   share of them classified exactly,
+	                                      over all patterns without one
+	rates.attributeRate(k)                share right on attribute k
+	rates.merge(other)                    adds another's counts into this shard
+	rates.reset()
+
+*/
+
+var openClassRates = function(buffer, attributes, shards, shard){
+	var K = attributes,
+		patterns = 1 << K,
+		stride = classRatesStride(K),
+		counts = new Int32Array(buffer),
+		own = shard * stride,
+		CORRECT = patterns, // Offsets within a shard
+		ATTRIBUTES = 2 * patterns,
+		TOTAL = 2 * patterns + K;
+
+	if (counts.length != shards * stride){
+		throw new Error("Class rates buffer does not match " + shards + " shards of " + K + " attributes");
+	}
+
+	var sum = function(slot){
+		var total = 0;
+		for (var s = 0; s < shards; s++){
+			total += Atomics.load(counts, s * stride + slot);
+		}
+		return total;
+	};
+
+	var rates = {
+		buffer: buffer,
+		attributes: K,
+		shards: shards,
+
+		record: function(truePattern, estimate){
+			Atomics.add(counts, own + truePattern, 1);
+			if (truePattern == estimate) Atomics.add(counts, own + CORRECT + truePattern, 1);
+
+			var wrong = truePattern ^ estimate;
+			for (var k = 0; k < K; k++){
+				if (!((wrong >>> k) & 1)) Atomics.add(counts, own + ATTRIBUTES + k, 1);
+			}
+			Atomics.add(counts, own + TOTAL, 1);
+		},
+
+		examinees: function(pattern){
+			return pattern == null ? sum(TOTAL) : sum(pattern);
+		},
+
+		rate: function(pattern){
+			var examinees, correct = 0;
+			if (pattern == null){
+				examinees = sum(TOTAL);
+				for (var p = 0; p < patterns; p++) correct += sum(CORRECT + p);
+			}
+			else {
+				examinees = sum(pattern);
+				correct = sum(CORRECT + pattern);
+			}
+			return examinees == 0 ? 0 : correct / examinees;
+		},
+
+		attributeRate: function(k){
+			var examinees = sum(TOTAL);
+			return examinees == 0 ? 0 : sum(ATTRIBUTES + k) / examinees;
+		},
+
+		merge: function(other){
+			if (other.attributes != K){
+				throw new Error("Cannot merge class rates of different attribute counts");
+			}
+			var theirs = new Int32Array(other.buffer);
+			for (var s = 0; s < other.shards; s++){
+				for (var slot = 0; slot < stride; slot++){
+					var value = Atomics.load(theirs, s * stride + slot);
+					if (value) Atomics.add(counts, own + slot, value);
+				}
+			}
+		},
+
+		reset: function(){
+			for (var i = 0; i < counts.length; i++) Atomics.store(counts, i, 0);
+		}
+	};
+
+	return rates;
+}
+
+
+module.exports = {
+	attributeMask: attributeMask,
+	dinaModel: dinaModel,
+	nidaModel: nidaModel,
+	patternTable: patternTable,
+	patternRow: patternRow,
+	estimatePattern: estimatePattern,
+	patternLogTables: patternLogTables,
+	createPatternSelector: createPatternSelector,
+	createClassRates: createClassRates,
+	openClassRates: openClassRates
+};
@@ -0,0 +1,368 @@
+/*
+Exposure
+----------------
+exposure.js
+
+Item exposure bookkeeping for cat.js. Counts are kept in flat arrays indexed
+by bank position (item.index), so recording an administered item is one array
+increment and the exposure rate of an item is one division.
+
+The counts live in a SharedArrayBuffer split into shards, one per thread.
+Each worker thread records into its own shard with Atomics, so threads never
+write the same slot, and readers add the shards up. Pass counter.buffer to
+the workers and open it there with openExposureCounter.
+
+*/
+
+var itemResponse = require('./itemResponse');
+
+
+/*
+@createExposureCounter
+@params options
+	items    number of bank positions to count (required)
+	capacity bank positions to make room for, counting items added later
+	         with addItem, default items
+	shards   number of threads that will record, default 1
+	shard    shard this thread records into, default 0
+
+Returns the counter algorithm, see openExposureCounter.
+
+*/
+
+var createExposureCounter = function(options){
+	var shards = options.shards || 1,
+		items = Math.max(options.items, options.capacity || 0),
+		buffer = new SharedArrayBuffer(shards * (items + 1) * 4);
+
+	return openExposureCounter(buffer, items, shards, options.shard || 0);
+}
+
+
+/*
+@openExposureCounter
+@params buffer, items, shards, shard
+
+Counter over an existing buffer, for a worker thread recording into shard.
+Each shard holds items + 1 Int32 slots: one count per bank position and the
+number of examinees last, so items is the capacity (counter.items). The
+buffer is shared with other threads and cannot grow under them; the
+bankSize hook refuses a bank larger than that, so addItem or useItemBank
+throws before the item can be selected instead of a test failing halfway.
+
+	counter.bankSize(items)                hook, throws past the capacity
+	counter.initialize(candidate)          hook, counts the examinee
+	counter.administered(candidate, item)  hook, counts the item
+	counter.count(index)                   times the item was administered
+	counter.examinees()                    examinees tested
+	counter.rate(index)                    count / examinees
+	counter.merge(other)                   adds another counter's counts into this shard
+	counter.reset()
+
+*/
+
+var openExposureCounter = function(buffer, items, shards, shard){
+	var stride = items + 1,
+		counts = new Int32Array(buffer),
+		own = shard * stride;
+
+	if (counts.length != shards * stride){
+		throw new Error("Exposure buffer does not match " + shards + " shards of " + items + " items");
+	}
+
+	var count = function(index){
+		var total = 0;
+		for (var s = 0; s < shards; s++){
+			total += Atomics.load(counts, s * stride + index);
+		}
+		return total;
+	};
+
+	var counter = {
+		name: "exposureCounter",
+		buffer: buffer,
+		items: items,
+		shards: shards,
+
+		initialize: function(candidate){
+			Atomics.add(counts, own + items, 1);
+		},
+
+		bankSize: function(size){
+			if (size > items){
+				throw new Error("The exposure counter has room for " + items + " items, not " + size +
+					"; create it with a larger capacity");
+			}
+		},
+
+		administered: function(candidate, item){
+			Atomics.add(counts, own + item.index, 1);
+		},
+
+		count: count,
+
+		examinees: function(){
+			return count(items);
+		},
+
+		rate: function(index){
+			var examinees = count(items);
+			return examinees == 0 ? 0 : count(index) / examinees;
+		},
+
+		merge: function(other){
+			if (other.items != items){
+				throw new Error("Cannot merge exposure counters of different bank sizes");
+			}
+			for (var i = 0; i <= items; i++){
+				Atomics.add(counts, own + i, other.count(i));
+			}
+		},
+
+		reset: function(){
+			for (var i = 0; i < counts.length; i++) Atomics.store(counts, i, 0);
+		}
+	};
+
+	return counter;
+}
+
+
+/*
+@createConditionalExposureCounter
+@params options
+	items    number of bank positions (required)
+	capacity bank positions to make room for, counting items added later
+	         with addItem, default items
+	min, max ability range covered by the bins, default 1 and 100 (bank scale)
+	bins     number of equal width ability bins, default 10
+
+Exposure counts conditional on ability, kept as a dense capacity x bins
+Int32Array (bin major) plus the number of examinees seen in each bin.
+binOf finds the bin of an ability in O(1). The counter has no hooks of its
+own; createConditionalExposureControl or createMaximumPriorityIndex feed
+it, so an item is always counted in the bin it was selected for, and their
+bankSize hooks refuse a bank larger than counter.items (the capacity).
+
+	counter.beginExaminee()      new examinee, forget the bins they visited
+	counter.record(index, bin)   item given in bin; counts the examinee in
+	                             the bin on their first item there
+	counter.binOf(ability)
+	counter.rate(index, bin)     count / examinees in that bin
+	counter.checkSize(items)     throws when items is past the capacity
+
+*/
+
+var createConditionalExposureCounter = function(options){
+	var items = Math.max(options.items, options.capacity || 0),
+		bins = options.bins || 10,
+		min = options.min == null ? 1 : options.min,
+		max = options.max == null ? 100 : options.max,
+		width = (max - min) / bins,
+		counts = new Int32Array(items * bins),
+		examinees = new Int32Array(bins),
+		visited = new Uint8Array(bins);
+
+	return {
+		items: items,
+		bins: bins,
+
+		binOf: function(ability){
+			var bin = Math.floor((ability - min) / width);
+			return bin < 0 ? 0 : (bin >= bins ? bins - 1 : bin);
+		},
+
+		beginExaminee: function(){
+			visited.fill(0);
+		},
+
+		record: function(index, bin){
+			if (!visited[bin]){
+				visited[bin] = 1;
+				examinees[bin]++;
+			}
+			counts[bin * items + index]++;
+		},
+
+		count: function(index, bin){
+			return counts[bin * items + index];
+		},
+
+		examinees: function(bin){
+			return examinees[bin];
+		},
+
+		rate: function(index, bin){
+			return examinees[bin] == 0 ? 0 : counts[bin * items + index] / examinees[bin];
+		},
+
+		reset: function(){
+			counts.fill(0);
+			examinees.fill(0);
+		},
+
+		// bankSize hook of the algorithms that feed the counter
+		checkSize: function(size){
+			if (size > items){
+				throw new Error("The conditional exposure counter has room for " + items + " items, not " +
+					size + "; create it with a larger capacity");
+			}
+		}
+	};
+}
+
+
+/*
+@createConditionalExposureControl
+@params counter (conditional exposure counter), options
+	rMax     maximum exposure rate within any ability bin, default 0.25
+	K        optional counter.items x bins conditional Sympson-Hetter
+	         parameters (bin major)
+	ability  function(candidate) giving the current ability estimate (required)
+	random   function returning [0, 1), default Math.random
+
+Algorithm for cat.js. approve looks up the item's rate in the bin of the
+candidate's current ability (one array read) and passes over items already at
+rMax in that bin, a hard cap on whatever selection is in use. With K it also
+applies conditional Sympson-Hetter: the item is given with probability
+K[bin][i]. administered then counts the item in the bin it was approved for.
+createMaximumPriorityIndex weights the selection itself instead.
+
+*/
+
+var createConditionalExposureControl = function(counter, options){
+	var rMax = options.rMax || 0.25,
+		K = options.K,
+		items = counter.items,
+		random = options.random || Math.random,
+		ability = options.ability,
+		approvedIndex = -1,
+		approvedBin = 0;
+
+	return {
+		name: "conditionalExposureControl",
+
+		bankSize: counter.checkSize,
+
+		initialize: function(candidate){
+			counter.beginExaminee();
+		},
+
+		approve: function(candidate, item){
+			var i = item.index,
+				bin = counter.binOf(ability(candidate));
+			if (counter.rate(i, bin) >= rMax) return false;
+			if (K && random() >= K[bin * items + i]) return false;
+
+			approvedIndex = i;
+			approvedBin = bin;
+			return true;
+		},
+
+		administered: function(candidate, item){
+			if (item.index == approvedIndex) counter.record(item.index, approvedBin);
+			approvedIndex = -1;
+		}
+	};
+}
+
+/*
+@createMaximumPriorityIndex
+@params cat (the cat.js module), counter (conditional exposure counter), options
+	rMax     maximum exposure rate within any ability bin, default 0.25
+	model    frozen table the information comes from, default "rasch"
+	theta(candidate, D)     ability in the model's units, default scaleDifficulty(D)
+	ability(candidate, D)   ability on the counter's scale, default D
+
+Conditional maximum priority index selection, a select hook for cat.js. Each
+eligible item's information at the current estimate is weighted by
+(1 - rate / rMax), its rate taken in the candidate's ability bin, and items
+are offered to the approve hooks by that priority, highest first. Items at
+or over rMax have no priority left and are not given. administered counts
+the item in the bin it was selected for. Register it in place of
+createConditionalExposureControl, not next to it.
+
+*/
+
+var createMaximumPriorityIndex = function(cat, counter, options){
+	options = options || {};
+	var rMax = options.rMax || 0.25,
+		model = options.model || "rasch",
+		theta = options.theta || function(candidate, D){
+			return itemResponse.scaleDifficulty(D);
+		},
+		ability = options.ability || function(candidate, D){
+			return D;
+		},
+		given = new Uint8Array(0),
+		priority = new Float64Array(0),
+		order = new Uint32Array(0),
+		selectedIndex = -1,
+		selectedBin = 0;
+
+	return {
+		name: "maximumPriorityIndex",
+
+		bankSize: counter.checkSize,
+
+		initialize: function(candidate){
+			counter.beginExaminee();
+			selectedIndex = -1;
+		},
+
+		select: function(candidate, D, mask){
+			var table = cat.bankTable(model),
+				n = table.length,
+				administered = cat.administeredItems(),
+				bin = counter.binOf(ability(candidate, D)),
+				at = theta(candidate, D),
+				count = 0,
+				i;
+
+			if (given.length < n){
+				given = new Uint8Array(n);
+				priority = new Float64Array(n);
+				order = new Uint32Array(n);
+			}
+			for (i = 0; i < administered.length; i++){
+				given[administered[i]] = 1;
+			}
+
+			for (i = 0; i < n; i++){
+				if (given[i] || (mask && !(mask[i >>> 5] & (1 << (i & 31)))) || cat.isRetired(i)) continue;
+				var weight = 1 - counter.rate(i, bin) / rMax;
+				if (weight <= 0) continue;
+				priority[i] = weight * itemResponse.itemInformation(table, i, at);
+				order[count++] = i;
+			}
+			for (i = 0; i < administered.length; i++){
+				given[administered[i]] = 0;
+			}
+
+			var ranked = order.subarray(0, count).sort(function(x, y){ return priority[y] - priority[x]; });
+			for (i = 0; i < count; i++){
+				var item = cat.bankItem(ranked[i]);
+				if (cat.approveItem(candidate, item)){
+					selectedIndex = item.index;
+					selectedBin = bin;
+					return item;
+				}
+			}
+			return undefined;
+		},
+
+		administered: function(candidate, item){
+			if (item.index == selectedIndex) counter.record(item.index, selectedBin);
+			selectedIndex = -1;
+		}
+	};
+}
+
+
+module.exports = {
+	createExposureCounter: createExposureCounter,
+	openExposureCounter: openExposureCounter,
+	createConditionalExposureCounter: createConditionalExposureCounter,
+	createConditionalExposureControl: createConditionalExposureControl,
+	createMaximumPriorityIndex: createMaximumPriorityIndex
+};
@@ -0,0 +1,545 @@
+/*
+Item Bank
+----------------
+itemBank.js
+
+Loads and stores the item bank that cat.js selects from. Large banks are kept
+in a versioned binary file that is read in one go and viewed through typed
+arrays, so opening a bank does not build one object per item. Item objects
+are only created when an item is actually requested; cat.useItemBank takes
+an opened bank directly and builds items through bank.item as the test
+reaches them.
+
+Binary bank layout (all numbers little endian, every section 8 byte aligned):
+
+	Header (48 bytes)
+		magic           "CATB"
+		version         uint16
+		flags           uint16   1 = float32 parameters
+		itemCount       uint32
+		modelCount      uint32
+		charCount       uint32   number of characteristics
+		stringBytes     uint32   size of the string blob
+		scaleMin        float64  bank difficulty scale, see scaleDifficulty
+		scaleMax        float64
+		reserved        uint32 x 2
+
+	Model table       modelCount x 8 byte ascii names ("rasch", "2pl", "3pl")
+	Characteristics   charCount x 16 byte ascii names
+	Item models       itemCount x uint8, index into the model table
+	Parameters        3 x itemCount float64 (float32 with flag 1), one column
+	                  each for difficulty, discrimination and psuedoChance
+	Bitmaps           charCount x ceil(itemCount / 32) uint32 words, bit i set
+	                  when item i has that characteristic
+	String offsets    (2 x itemCount + 1) uint32, question then answer
+	String blob       utf8
+
+*/
+
+var fs = require('fs');
+var StringDecoder = require('string_decoder').StringDecoder;
+var itemResponse = require('./itemResponse');
+
+var BANK_MAGIC = "CATB",
+	BANK_VERSION = 1,
+	HEADER_BYTES = 48,
+	MODEL_NAME_BYTES = 8,
+	CHAR_NAME_BYTES = 16,
+	BANK_MODELS = ["rasch", "2pl", "3pl"],
+	FLAG_FLOAT32 = 1;
+
+
+/*
+@align
+@params offset
+
+Rounds a byte offset up to the next multiple of 8 so Float64Array views stay
+aligned.
+
+*/
+
+var align = function(offset){
+	return (offset + 7) & ~7;
+}
+
+
+/*
+@bankLayout
+@params itemCount, modelCount, charCount, stringBytes, paramBytes (8 or 4)
+
+Byte offsets of every section in a bank file.
+
+*/
+
+var bankLayout = function(itemCount, modelCount, charCount, stringBytes, paramBytes){
+	var layout = {},
+		offset = HEADER_BYTES;
+
+	layout.models = offset;
+	offset = align(offset + modelCount * MODEL_NAME_BYTES);
+	layout.characteristics = offset;
+	offset = align(offset + charCount * CHAR_NAME_BYTES);
+	layout.itemModels = offset;
+	offset = align(offset + itemCount);
+	layout.params = offset;
+	offset = align(offset + 3 * itemCount * paramBytes);
+	layout.words = Math.ceil(itemCount / 32);
+	layout.bitmaps = offset;
+	offset = align(offset + charCount * layout.words * 4);
+	layout.strings = offset;
+	offset = align(offset + (2 * itemCount + 1) * 4);
+	layout.blob = offset;
+	layout.size = offset + stringBytes;
+
+	return layout;
+}
+
+
+/*
+@writeBankFile
+@params path, items, options
+	precision   "float64" (default) or "float32"
+	scale       difficulty scale [min, max] for the header, default the one
+	            in use (getDifficultyScale in itemResponse.js)
+
+Writes an item bank in the binary format above. Each item is
+{ question, answer, difficulty, discrimination, psuedoChance, model,
+characteristics: ["name", ...] }. Missing discrimination defaults to 1,
+missing psuedoChance to 0 and missing model to "rasch". float32 halves the
+parameter storage of very large banks, see checkTablePrecision in
+itemResponse.js for the precision contract. The opened bank reports the
+scale as bank.scale, ready for setDifficultyScale(bank.scale).
+
+*/
+
+var writeBankFile = function(path, items, options){
+	var charNames = [],
+		charIndex = Object.create(null),
+		strings = [],
+		stringBytes = 0;
+
+	items.forEach(function(item){
+		(item.characteristics || []).forEach(function(name){
+			if (!(name in charIndex)){
+				charIndex[name] = charNames.length;
+				charNames.push(name);
+			}
+		});
+		[item.question || "", item.answer || ""].forEach(function(text){
+			var bytes = Buffer.from(String(text), 'utf8');
+			strings.push(bytes);
+			stringBytes += bytes.length;
+		});
+	});
+
+	var single = !!(options && options.precision == "float32"),
+		scale = (options && options.scale) || itemResponse.getDifficultyScale(),
+		n = items.length,
+		layout = bankLayout(n, BANK_MODELS.length, charNames.length, stringBytes, single ? 4 : 8),
+		buf = Buffer.alloc(layout.size);
+
+	buf.write(BANK_MAGIC, 0, 'ascii');
+	buf.writeUInt16LE(BANK_VERSION, 4);
+	buf.writeUInt16LE(single ? FLAG_FLOAT32 : 0, 6);
+	buf.writeUInt32LE(n, 8);
+	buf.writeUInt32LE(BANK_MODELS.length, 12);
+	buf.writeUInt32LE(charNames.length, 16);
+	buf.writeUInt32LE(stringBytes, 20);
+	buf.writeDoubleLE(scale[0], 24);
+	buf.writeDoubleLE(scale[1], 32);
+
+	BANK_MODELS.forEach(function(name, m){
+		buf.write(name, layout.models + m * MODEL_NAME_BYTES, MODEL_NAME_BYTES, 'ascii');
+	});
+	charNames.forEach(function(name, c){
+		if (Buffer.byteLength(name, 'ascii') > CHAR_NAME_BYTES){
+			throw new Error("Characteristic name too long: " + name);
+		}
+		buf.write(name, layout.characteristics + c * CHAR_NAME_BYTES, CHAR_NAME_BYTES, 'ascii');
+	});
+
+	var bitmaps = new Uint32Array(buf.buffer, buf.byteOffset + layout.bitmaps, charNames.length * layout.words),
+		params = new (single ? Float32Array : Float64Array)(buf.buffer, buf.byteOffset + layout.params, 3 * n);
+
+	items.forEach(function(item, i){
+		var model = BANK_MODELS.indexOf(item.model || "rasch");
+		if (model < 0) throw new Error("Unknown model " + item.model);
+
+		buf.writeUInt8(model, layout.itemModels + i);
+		params[i] = item.difficulty;
+		params[n + i] = item.discrimination == null ? 1 : item.discrimination;
+		params[2 * n + i] = item.psuedoChance == null ? 0 : item.psuedoChance;
+
+		(item.characteristics || []).forEach(function(name){
+			var c = charIndex[name];
+			bitmaps[c * layout.words + (i >>> 5)] |= 1 << (i & 31);
+		});
+	});
+
+	var offset = 0;
+	strings.forEach(function(bytes, s){
+		buf.writeUInt32LE(offset, layout.strings + s * 4);
+		bytes.copy(buf, layout.blob + offset);
+		offset += bytes.length;
+	});
+	buf.writeUInt32LE(offset, layout.strings + strings.length * 4);
+
+	fs.writeFileSync(path, buf);
+}
+
+
+/*
+@openBankFile
+@params path
+
+Opens a binary bank written by writeBankFile. The file is read with a single
+read and the returned bank only holds typed array views over it:
+
+	bank.length                  number of items
+	bank.difficulty, .discrimination, .psuedoChance   Float64Array columns
+	                             (Float32Array for a float32 bank)
+	bank.model(i)                model name of item i
+	bank.hasCharacteristic(i, name)
+	bank.item(i)                 item object, built on first request and cached
+
+*/
+
+var openBankFile = function(path){
+	var buf = fs.readFileSync(path);
+
+	// Typed array views need 8 byte alignment inside the underlying buffer.
+	if (buf.byteOffset % 8 != 0){
+		buf = Buffer.from(buf);
+	}
+
+	if (buf.length < HEADER_BYTES || buf.toString('ascii', 0, 4) != BANK_MAGIC){
+		throw new Error(path + " is not an item bank file");
+	}
+	var version = buf.readUInt16LE(4);
+	if (version != BANK_VERSION){
+		throw new Error(path + ": unsupported bank version " + version);
+	}
+
+	var single = (buf.readUInt16LE(6) & FLAG_FLOAT32) != 0,
+		n = buf.readUInt32LE(8),
+		modelCount = buf.readUInt32LE(12),
+		charCount = buf.readUInt32LE(16),
+		stringBytes = buf.readUInt32LE(20),
+		layout = bankLayout(n, modelCount, charCount, stringBytes, single ? 4 : 8);
+
+	if (buf.length < layout.size){
+		throw new Error(path + ": truncated item bank file");
+	}
+
+	var readName = function(offset, size){
+		return buf.toString('ascii', offset, offset + size).replace(/\0+$/, "");
+	};
+
+	var models = [],
+		characteristics = Object.create(null);
+	for (var m = 0; m < modelCount; m++){
+		models.push(readName(layout.models + m * MODEL_NAME_BYTES, MODEL_NAME_BYTES));
+	}
+	for (var c = 0; c < charCount; c++){
+		characteristics[readName(layout.characteristics + c * CHAR_NAME_BYTES, CHAR_NAME_BYTES)] = c;
+	}
+
+	var base = buf.byteOffset,
+		itemModels = new Uint8Array(buf.buffer, base + layout.itemModels, n),
+		params = new (single ? Float32Array : Float64Array)(buf.buffer, base + layout.params, 3 * n),
+		bitmaps = new Uint32Array(buf.buffer, base + layout.bitmaps, charCount * layout.words),
+		stringOffsets = new Uint32Array(buf.buffer, base + layout.strings, 2 * n + 1),
+		materialized = [];
+
+	var readString = function(s){
+		return buf.toString('utf8', layout.blob + stringOffsets[s], layout.blob + stringOffsets[s + 1]);
+	};
+
+	var bank = {
+		length: n,
+		precision: single ? "float32" : "float64",
+		scale: [buf.readDoubleLE(24), buf.readDoubleLE(32)],
+		difficulty: params.subarray(0, n),
+		discrimination: params.subarray(n, 2 * n),
+		psuedoChance: params.subarray(2 * n, 3 * n),
+		bitmaps: bitmaps,
+		words: layout.words,
+		characteristics: characteristics
+	};
+
+	bank.model = function(i){
+		return models[itemModels[i]];
+	};
+
+	bank.hasCharacteristic = function(i, name){
+		var c = characteristics[name];
+		if (c == null) return false;
+		return (bitmaps[c * layout.words + (i >>> 5)] & (1 << (i & 31))) != 0;
+	};
+
+	bank.item = function(i){
+		if (materialized[i]) return materialized[i];
+
+		var item = {
+			index: i,
+			question: readString(2 * i),
+			answer: readString(2 * i + 1),
+			difficulty: bank.difficulty[i],
+			discrimination: bank.discrimination[i],
+			psuedoChance: bank.psuedoChance[i],
+			model: bank.model(i),
+			characteristics: []
+		};
+		for (var name in characteristics){
+			if (bank.hasCharacteristic(i, name)) item.characteristics.push(name);
+		}
+
+		materialized[i] = item;
+		return item;
+	};
+
+	return bank;
+}
+
+
+// ================ DELIMITED TABLE LOADING ========================
+
+var TABLE_CHUNK_BYTES = 1 << 20;
+
+var ITEM_COLUMNS = {
+	question: "string",
+	answer: "string",
+	difficulty: "number",
+	discrimination: "number",
+	psuedoChance: "number",
+	model: "string",
+	characteristics: "list"
+};
+
+var PERSON_COLUMNS = {
+	name: "string",
+	ability: "number"
+};
+
+
+/*
+@parseNumber
+@params text
+
+Parses a plain decimal number ("-1.25", "3", "2.5e-3") straight from the
+character codes. Exponents and very long mantissas are handed to Number so
+they round the same way. Anything else (inf, nan, hex, empty) returns NaN.
+
+*/
+
+var parseNumber = function(text){
+	var i = 0,
+		n = text.length,
+		sign = 1,
+		value = 0,
+		digits = 0;
+
+	if (text.charCodeAt(0) == 45){ sign = -1; i++; } // '-'
+	else if (text.charCodeAt(0) == 43){ i++; }       // '+'
+
+	for (; i < n; i++){
+		var d = text.charCodeAt(i) - 48;
+		if (d < 0 || d > 9) break;
+		value = value * 10 + d;
+		digits++;
+	}
+
+	if (i < n && text.charCodeAt(i) == 46){ // '.'
+		var scale = 1;
+		for (i++; i < n; i++){
+			var d = text.charCodeAt(i) - 48;
+			if (d < 0 || d > 9) break;
+			value = value * 10 + d;
+			scale *= 10;
+			digits++;
+		}
+		value /= scale;
+	}
+
+	if (digits == 0) return NaN;
+
+	// Past 15 digits the running value is no longer exact, let Number round it.
+	if (digits > 15) return Number(text);
+
+	if (i < n && (text.charCodeAt(i) | 32) == 101){ // 'e' or 'E'
+		var exponent = text.slice(i + 1);
+		if (!/^[+-]?[0-9]+$/.test(exponent)) return NaN;
+		return Number(text);
+	}
+
+	return i == n ? sign * value : NaN;
+}
+
+
+/*
+@readTable
+@params path, delimiter, onHeader(fields), onRow(fields, row)
+
+Reads a delimited text file in fixed size chunks, carrying the partial last
+line of each chunk into the next one (StringDecoder keeps multi-byte
+characters split across chunks intact). Blank lines are skipped, but row is
+the line number in the file (header is line 1) so errors point at the right
+line. Fields are not unquoted, so pick a delimiter that does not appear in
+the data (tab for question text).
+
+*/
+
+var readTable = function(path, delimiter, onHeader, onRow){
+	var fd = fs.openSync(path, 'r'),
+		chunk = Buffer.alloc(TABLE_CHUNK_BYTES),
+		carry = "",
+		decoder = new StringDecoder('utf8'),
+		line = 0, // Physical line number, blank lines included
+		headerSeen = false,
+		bytesRead;
+
+	var handleLine = function(text){
+		line++;
+		if (text.charCodeAt(text.length - 1) == 13) text = text.slice(0, -1);
+		if (text.length == 0) return;
+
+		var fields = text.split(delimiter);
+		if (!headerSeen){
+			headerSeen = true;
+			onHeader(fields);
+		}
+		else onRow(fields, line);
+	};
+
+	try {
+		while ((bytesRead = fs.readSync(fd, chunk, 0, TABLE_CHUNK_BYTES, null)) > 0){
+			var text = carry + decoder.write(chunk.subarray(0, bytesRead)),
+				start = 0,
+				newline;
+
+			while ((newline = text.indexOf("\n", start)) >= 0){
+				handleLine(text.slice(start, newline));
+				start = newline + 1;
+			}
+			carry = text.slice(start);
+		}
+		carry += decoder.end();
+		handleLine(carry);
+	}
+	finally {
+		fs.closeSync(fd);
+	}
+}
+
+
+/*
+@loadTable
+@params path, columns, options
+
+Shared loader for loadItemTable and loadPersonTable. The header row is mapped
+to column setters once; every following row is filled through that mapping.
+Unknown header columns are ignored. Rows with a bad number or the wrong field
+count are reported in errors and left out of rows.
+
+*/
+
+var loadTable = function(path, columns, options){
+	options = options || {};
+
+	var delimiter = options.delimiter || ",",
+		listDelimiter = options.listDelimiter || ";",
+		required = options.required || [],
+		mapping = [],
+		rows = [],
+		errors = [];
+
+	var onHeader = function(fields){
+		fields.forEach(function(name, col){
+			name = name.trim();
+			if (columns[name]) mapping.push({ col: col, name: name, type: columns[name] });
+		});
+		required.forEach(function(name){
+			if (!mapping.some(function(m){ return m.name == name; })){
+				throw new Error(path + ": missing column " + name);
+			}
+		});
+		mapping.columnCount = fields.length;
+	};
+
+	var onRow = function(fields, row){
+		if (fields.length != mapping.columnCount){
+			errors.push({ row: row, message: "expected " + mapping.columnCount + " fields, found " + fields.length });
+			return;
+		}
+
+		var record = {};
+		for (var m = 0; m < mapping.length; m++){
+			var column = mapping[m],
+				field = fields[column.col];
+
+			if (column.type == "number"){
+				var value = parseNumber(field.trim());
+				if (value !== value){ // NaN
+					errors.push({ row: row, message: "bad number in " + column.name + ": " + field });
+					return;
+				}
+				record[column.name] = value;
+			}
+			else if (column.type == "list"){
+				record[column.name] = field ? field.split(listDelimiter) : [];
+			}
+			else {
+				record[column.name] = field;
+			}
+		}
+		rows.push(record);
+	};
+
+	readTable(path, delimiter, onHeader, onRow);
+
+	return { rows: rows, errors: errors };
+}
+
+
+/*
+@loadItemTable
+@params path, options { delimiter, listDelimiter }
+
+Loads an item parameter table with a header row naming any of question,
+answer, difficulty, discrimination, psuedoChance, model and characteristics
+(list separated by listDelimiter, ";" by default). difficulty is required.
+Returns { items, errors: [{ row, message }] }; the items can go straight into
+writeBankFile.
+
+*/
+
+var loadItemTable = function(path, options){
+	options = Object.assign({ required: ["difficulty"] }, options);
+	var table = loadTable(path, ITEM_COLUMNS, options);
+	return { items: table.rows, errors: table.errors };
+}
+
+
+/*
+@loadPersonTable
+@params path, options { delimiter }
+
+Loads a person table with name and ability columns, in the same shape as the
+candidateBank in cat.js. Returns { persons, errors: [{ row, message }] }.
+
+*/
+
+var loadPersonTable = function(path, options){
+	options = Object.assign({ required: ["ability"] }, options);
+	var table = loadTable(path, PERSON_COLUMNS, options);
+	return { persons: table.rows, errors: table.errors };
+}
+
+module.exports = {
+	BANK_VERSION: BANK_VERSION,
+	writeBankFile: writeBankFile,
+	openBankFile: openBankFile,
+	parseNumber: parseNumber,
+	loadItemTable: loadItemTable,
+	loadPersonTable: loadPersonTable
+};
@@ -35,11 +35,11 @@ itemDif =
 	
 var raschModel = function(itemDifficulty, latentAbility){
 
-	theta = scaleDifficulty(latentAbility);
-	b = scaleDifficulty(itemDifficulty);
+	var theta = scaleDifficulty(latentAbility);
+	var b = scaleDifficulty(itemDifficulty);
 
 
-	result = ( Math.exp(theta - b) / (1 + Math.exp(theta - b)) ) 
+	var result = ( Math.exp(theta - b) / (1 + Math.exp(theta - b)) ) 
 	return result;
 }
 
@@ -58,7 +58,7 @@ var brinbaumModel = function(itemDifficulty, latentAbility, discrimination){
 	var numerator = (Math.exp(discrimination * (latentAbility - itemDifficulty)));
 	var denominator = 1 + (Math.exp(discrimination * (latentAbility - itemDifficulty)));
 
-	result = (numerator / denominator);
+	var result = (numerator / denominator);
 	return result;
 
 }
@@ -75,26 +75,60 @@ guessing.
 
 var threeParamModel = function(itemDifficulty, latentAbility, discrimination, psuedoChance){
 
-	numerator = (1 - psuedoChance);
-	denominator = 1 + (Math.exp(-1.7 * (discrimination) * (latentAbility - itemDifficulty)));
+	var numerator = (1 - psuedoChance);
+	var denominator = 1 + (Math.exp(-1.7 * (discrimination) * (latentAbility - itemDifficulty)));
 
-	result = psuedoChance + (numerator / denominator);
+	var result = psuedoChance + (numerator / denominator);
 	return result;
 }
 
 
+/*
+@setDifficultyScale
+@params from [min, max], to [min, max] (optional, default [-3, 3])
+
+Sets the range scaleDifficulty maps from and to. The slope and offset are
+worked out here once instead of on every probability evaluation. A binary
+bank's scale can be applied with setDifficultyScale(bank.scale).
+
+Every change bumps the scale generation that freezeItemTable stamps on its
+tables (table.scale), so holders of frozen tables can tell theirs were
+scaled with an old slope and freeze them again; cat.js bankTable does.
+
+*/
+
+var scaleFromMin = 1,
+	scaleFromMax = 100,
+	scaleToMin = -3,
+	scaleSlope = 6 / 99,
+	scaleGeneration = 0;
+
+var setDifficultyScale = function(from, to){
+	to = to || [-3, 3];
+	if (!(from[1] != from[0])) throw new Error("Empty difficulty scale " + from[0] + " to " + from[1]);
+	scaleGeneration++;
+	scaleFromMin = from[0];
+	scaleFromMax = from[1];
+	scaleToMin = to[0];
+	scaleSlope = (to[1] - to[0]) / (from[1] - from[0]);
+}
+
+// The [min, max] range difficulties are currently scaled from
+var getDifficultyScale = function(){
+	return [scaleFromMin, scaleFromMax];
+}
+
 /*
 @scaleDifficulty
-@params value to convert, range1 [...], range2 [.....]
+@params value to convert
 
-Scales item difficulty from 1-100 to -3 to 3 for raschModel.
+Scales item difficulty from 1-100 to -3 to 3 for raschModel (or the ranges
+given to setDifficultyScale).
 
 */
 
 function scaleDifficulty( value) { 
-	r1 = [1, 100];
-	r2 = [-3, 3];
-    return ( value - r1[ 0 ] ) * ( r2[ 1 ] - r2[ 0 ] ) / ( r1[ 1 ] - r1[ 0 ] ) + r2[ 0 ];
+    return ( value - scaleFromMin ) * scaleSlope + scaleToMin;
 }
 
 
@@ -108,7 +142,7 @@ Equation: e ^ ( probability of success / probability of failure) => e ^ (raschMo
 */
 
 var logOddsModel = function(raschProbability){
-	logit = Math.exp( raschProbability / (1 - raschProbability));
+	var logit = Math.exp( raschProbability / (1 - raschProbability));
 
 	return logit;
 }
@@ -126,7 +160,426 @@ Maximum Likelihood Estimator, MLE of theta.
 
 */
 
+var ESTIMATE_MIN = -4,
+	ESTIMATE_MAX = 4,
+	QUADRATURE_POINTS = 41;
+
+// EAP quadrature grid and standard normal log prior, worked out once
+var QUADRATURE_THETA = new Float64Array(QUADRATURE_POINTS),
+	QUADRATURE_LOG_PRIOR = new Float64Array(QUADRATURE_POINTS);
+
+for (var q = 0; q < QUADRATURE_POINTS; q++){
+	QUADRATURE_THETA[q] = ESTIMATE_MIN + q * (ESTIMATE_MAX - ESTIMATE_MIN) / (QUADRATURE_POINTS - 1);
+	QUADRATURE_LOG_PRIOR[q] = -0.5 * QUADRATURE_THETA[q] * QUADRATURE_THETA[q];
+}
+
+/*
+@itemParameters
+@params item, model ("rasch", "2pl" or "3pl")
+
+Reads the logistic parameters a (discrimination), b (difficulty) and
+c (pseudo chance) of an item for the given model. Rasch difficulties live on
+the 1-100 bank scale and are scaled to logits, the same way raschModel does.
+The 3 parameter model keeps its 1.7 scaling constant inside a.
+
+*/
+
+var itemParameters = function(item, model){
+	if (model == "rasch"){
+		return { a: 1, b: scaleDifficulty(item.difficulty), c: 0 };
+	}
+	if (model == "2pl"){
+		return { a: item.discrimination, b: item.difficulty, c: 0 };
+	}
+	if (model == "3pl"){
+		return { a: 1.7 * item.discrimination, b: item.difficulty, c: item.psuedoChance };
+	}
+	throw new Error("Unknown model " + model);
+}
+
+/*
+@logisticProbability
+@params a, b, c, theta
+
+P(theta) = c + (1 - c) / (1 + exp(-a(theta - b)))
+
+*/
+
+var logisticProbability = function(a, b, c, theta){
+	return c + (1 - c) / (1 + Math.exp(-a * (theta - b)));
+}
+
+/*
+@freezeItemTable
+@params items, model, precision ("float64" default, or "float32")
+
+Reads the parameters of every item once into contiguous Float64Array columns
+{ length, a, b, c }, so criteria and estimators index them by bank position
+instead of going back to the item objects (and itemParameters) on every
+evaluation. Build it again if the bank changes. table.scale records the
+difficulty scale generation (see setDifficultyScale) Rasch b was scaled with.
+items can also be a bank opened with openBankFile (itemBank.js), whose
+parameter columns are read directly without building its item objects.
+
+"float32" stores Float32Array columns instead, half the memory for very large
+banks. Probabilities computed from a float32 table stay within
+FLOAT32_TOLERANCE of the float64 ones (see checkTablePrecision).
+
+*/
+
+var FLOAT32_TOLERANCE = 1e-5;
+
+var freezeItemTable = function(items, model, precision){
+	var n = items.length,
+		Column = precision == "float32" ? Float32Array : Float64Array,
+		table = { length: n, precision: precision || "float64", scale: scaleGeneration,
+			a: new Column(n), b: new Column(n), c: new Column(n) },
+		columns = Array.isArray(items) ? null : items,
+		columnItem = { difficulty: 0, discrimination: 1, psuedoChance: 0 };
+
+	for (var i = 0; i < n; i++){
+		var item = items[i];
+		if (columns){
+			columnItem.difficulty = columns.difficulty[i];
+			columnItem.discrimination = columns.discrimination[i];
+			columnItem.psuedoChance = columns.psuedoChance[i];
+			item = columnItem;
+		}
+		var p = itemParameters(item, model);
+		table.a[i] = p.a;
+		table.b[i] = p.b;
+		table.c[i] = p.c;
+	}
+	return table;
+}
+
+/*
+@freezeModelTable
+@params items, models (e.g. ["rasch", "3pl"]), precision
+
+One frozen item table per model key: table[model].b[index].
+
+*/
+
+var freezeModelTable = function(items, models, precision){
+	var tables = Object.create(null);
+	models.forEach(function(model){
+		tables[model] = freezeItemTable(items, model, precision);
+	});
+	return tables;
+}
+
+/*
+@checkTablePrecision
+@params items, model
+
+The float32 precision contract. Compares P(theta) from a float32 and a
+float64 table of the same items over theta in [-4, 4] (step 0.1) and returns
+{ maxError, ok } where ok means maxError <= FLOAT32_TOLERANCE. Run it on a
+bank before switching it to float32 storage.
+
+*/
+
+var checkTablePrecision = function(items, model){
+	var single = freezeItemTable(items, model, "float32"),
+		full = freezeItemTable(items, model),
+		maxError = 0;
+
+	for (var i = 0; i < full.length; i++){
+		for (var t = -40; t <= 40; t++){
+			var theta = t / 10,
+				error = Math.abs(tableProbability(single, i, theta) - tableProbability(full, i, theta));
+			if (error > maxError) maxError = error;
+		}
+	}
+
+	return { maxError: maxError, ok: maxError <= FLOAT32_TOLERANCE };
+}
+
+/*
+@tableProbability
+@params table, index, theta
+
+P(theta) of the item at bank position index in a frozen table.
+
+*/
+
+var tableProbability = function(table, index, theta){
+	return logisticProbability(table.a[index], table.b[index], table.c[index], theta);
+}
+
+/*
+@itemInformation
+@params table (frozen item table), index, theta
+
+Fisher information of the item at theta,
+a^2 (1 - P) / P ((P - c) / (1 - c))^2.
+
+*/
+
+var itemInformation = function(table, index, theta){
+	var a = table.a[index],
+		c = table.c[index],
+		P = tableProbability(table, index, theta),
+		core = (P - c) / (1 - c);
+	return a * a * core * core * (1 - P) / P;
+}
+
+/*
+@toParameterTable
+@params params, into (optional table to reuse)
+
+Turns an array of { a, b, c } (from itemParameters) into the column form
+used by the estimators. Frozen tables pass straight through. With into the
+columns of that table are reused (grown when too short) instead of built
+anew; estimateAbility converts into one scratch table this way.
+
+*/
+
+var toParameterTable = function(params, into){
+	if (!Array.isArray(params)) return params;
+
+	var n = params.length,
+		table = into || { length: 0, a: null, b: null, c: null };
+	if (!table.a || table.a.length < n){
+		table.a = new Float64Array(n);
+		table.b = new Float64Array(n);
+		table.c = new Float64Array(n);
+	}
+	table.length = n;
+	for (var i = 0; i < n; i++){
+		table.a[i] = params[i].a;
+		table.b[i] = params[i].b;
+		table.c[i] = params[i].c;
+	}
+	return table;
+}
+
+// Columns estimateAbility converts arrays of parameters into, reused per call
+var PARAMETER_SCRATCH = { length: 0, a: null, b: null, c: null };
+
+/*
+@estimateAbility
+@params responses, table, estimator ("MLE", "MAP" or "EAP"), out (optional)
+
+responses[i] is 1 (right), 0 (wrong) or null (not administered) for item i
+of table, a frozen item table (or an array of itemParameters results).
+Returns { theta, standardError } in logits, written into out when given so
+loops that estimate once per item do not create a result object each time.
+
+MLE and MAP use Newton-Raphson with Fisher scoring, MAP adds a standard normal
+prior. MLE is bounded to [-4, 4] since all right / all wrong vectors diverge.
+EAP integrates the posterior over a quadrature grid, refined for long tests.
+
+*/
+
+var estimateAbility = function(responses, table, estimator, out){
+	table = toParameterTable(table, PARAMETER_SCRATCH);
+	out = out || {};
+
+	if (estimator == "EAP"){
+		return expectedAPosteriori(responses, table, out);
+	}
+
+	var usePrior = (estimator == "MAP");
+	if (!usePrior && estimator != "MLE"){
+		throw new Error("Unknown estimator " + estimator);
+	}
+
+	var theta = 0,
+		information = 0;
+
+	for (var iter = 0; iter < 50; iter++){
+		var gradient = usePrior ? -theta : 0;
+		information = usePrior ? 1 : 0;
+
+		for (var i = 0; i < responses.length; i++){
+			if (responses[i] == null) continue;
+			var a = table.a[i],
+				c = table.c[i],
+				P = logisticProbability(a, table.b[i], c, theta),
+				Pstar = (P - c) / (1 - c);
+
+			gradient += a * Pstar * (responses[i] - P) / P;
+			information += a * a * Pstar * Pstar * (1 - P) / P;
+		}
+
+		if (information <= 0) break;
+
+		var step = gradient / information;
+		theta = Math.min(ESTIMATE_MAX, Math.max(ESTIMATE_MIN, theta + step));
+		if (Math.abs(step) < 1e-6) break;
+	}
+
+	out.theta = theta;
+	out.standardError = information > 0 ? 1 / Math.sqrt(information) : Infinity;
+	return out;
+}
+
+/*
+@expectedAPosteriori
+@params responses, table, out
+
+EAP estimate with a standard normal prior. Posterior mean and standard
+deviation over QUADRATURE_POINTS evenly spaced points in [-4, 4]. The log
+posterior is shifted by its largest value before exponentiating, so long
+response vectors do not underflow. When the posterior is narrow next to the
+grid spacing (long tests) the integral is taken again over a finer grid
+around the mean, so the standard error is not understated.
+
+*/
+
+var QUADRATURE_LOG_POSTERIOR = new Float64Array(QUADRATURE_POINTS);
 
+var expectedAPosteriori = function(responses, table, out){
+	var lo = ESTIMATE_MIN,
+		hi = ESTIMATE_MAX;
+
+	quadraturePosterior(responses, table, lo, hi, out);
+
+	for (var refine = 0; refine < 3; refine++){
+		var spacing = (hi - lo) / (QUADRATURE_POINTS - 1);
+		if (out.standardError > 2 * spacing) break;
+
+		var half = Math.max(6 * out.standardError, 2 * spacing);
+		lo = Math.max(ESTIMATE_MIN, out.theta - half);
+		hi = Math.min(ESTIMATE_MAX, out.theta + half);
+		quadraturePosterior(responses, table, lo, hi, out);
+	}
+	return out;
+}
+
+// Posterior mean and standard deviation over QUADRATURE_POINTS points in [lo, hi]
+var quadraturePosterior = function(responses, table, lo, hi, out){
+	var fullGrid = (lo == ESTIMATE_MIN && hi == ESTIMATE_MAX),
+		largest = -Infinity,
+		total = 0,
+		first = 0,
+		second = 0,
+		theta,
+		q;
+
+	for (q = 0; q < QUADRATURE_POINTS; q++){
+		theta = fullGrid ? QUADRATURE_THETA[q] : lo + q * (hi - lo) / (QUADRATURE_POINTS - 1);
+		var logPosterior = fullGrid ? QUADRATURE_LOG_PRIOR[q] : -0.5 * theta * theta;
+
+		for (var i = 0; i < responses.length; i++){
+			if (responses[i] == null) continue;
+			var P = tableProbability(table, i, theta);
+			logPosterior += Math.log(responses[i] == 1 ? P : 1 - P);
+		}
+
+		QUADRATURE_LOG_POSTERIOR[q] = logPosterior;
+		if (logPosterior > largest) largest = logPosterior;
+	}
+
+	for (q = 0; q < QUADRATURE_POINTS; q++){
+		theta = fullGrid ? QUADRATURE_THETA[q] : lo + q * (hi - lo) / (QUADRATURE_POINTS - 1);
+		var weight = Math.exp(QUADRATURE_LOG_POSTERIOR[q] - largest);
+		total += weight;
+		first += weight * theta;
+		second += weight * theta * theta;
+	}
+
+	var mean = first / total;
+	out.theta = mean;
+	out.standardError = Math.sqrt(Math.max(0, second / total - mean * mean));
+	return out;
+}
+
+/*
+@scoreBatch
+@params responseMatrix, items, model, estimator
+
+Rescores completed response vectors, e.g. after a bank is recalibrated.
+responseMatrix[e][i] is examinee e's response to items[i]. Item parameters are
+frozen once for the whole batch and each examinee gets a single final-pass
+estimate. Returns an array of { theta, standardError }.
+
+*/
+
+var scoreBatch = function(responseMatrix, items, model, estimator){
+	var table = freezeItemTable(items, model);
+
+	return responseMatrix.map(function(responses){
+		return estimateAbility(responses, table, estimator);
+	});
+}
+
+/*
+@scoreBatchParallel
+@params responseMatrix, items, model, estimator, workers, callback(err, results)
+
+Same as scoreBatch, but splits the examinees into contiguous slices and scores
+each slice on a worker thread (scoreWorker.js). Results come back in the
+original examinee order.
+
+*/
+
+var scoreBatchParallel = function(responseMatrix, items, model, estimator, workers, callback){
+	var Worker = require('worker_threads').Worker,
+		path = require('path');
+
+	workers = Math.max(1, Math.min(workers, responseMatrix.length));
+	var sliceSize = Math.ceil(responseMatrix.length / workers),
+		results = new Array(responseMatrix.length),
+		pending = workers,
+		failed = false;
+
+	if (responseMatrix.length == 0){
+		return callback(null, results);
+	}
+
+	for (var w = 0; w < workers; w++){
+		(function(start){
+			var worker = new Worker(path.join(__dirname, 'scoreWorker.js'), {
+				workerData: {
+					responseMatrix: responseMatrix.slice(start, start + sliceSize),
+					items: items,
+					model: model,
+					estimator: estimator
+				}
+			});
+
+			worker.on('message', function(slice){
+				for (var i = 0; i < slice.length; i++){
+					results[start + i] = slice[i];
+				}
+				if (--pending == 0 && !failed) callback(null, results);
+			});
+
+			worker.on('error', function(err){
+				if (failed) return;
+				failed = true;
+				callback(err);
+			});
+		})(w * sliceSize);
+	}
+}
+
+
+
+module.exports = {
+	raschModel: raschModel,
+	brinbaumModel: brinbaumModel,
+	threeParamModel: threeParamModel,
+	scaleDifficulty: scaleDifficulty,
+	setDifficultyScale: setDifficultyScale,
+	getDifficultyScale: getDifficultyScale,
+	difficultyScaleGeneration: function(){ return scaleGeneration; },
+	logOddsModel: logOddsModel,
+	itemParameters: itemParameters,
+	freezeItemTable: freezeItemTable,
+	freezeModelTable: freezeModelTable,
+	checkTablePrecision: checkTablePrecision,
+	FLOAT32_TOLERANCE: FLOAT32_TOLERANCE,
+	tableProbability: tableProbability,
+	itemInformation: itemInformation,
+	logisticProbability: logisticProbability,
+	estimateAbility: estimateAbility,
+	scoreBatch: scoreBatch,
+	scoreBatchParallel: scoreBatchParallel
+};
 
 
 // ========================TESTING ================================
@@ -159,62 +612,64 @@ Maximum Likelihood Estimator, MLE of theta.
 
 
 
-console.log("Testing dummy data");
+// Only plot the dummy curves when run directly, not when required.
+if (require.main === module){
 
-var dummyDifficultyFour = 90;
-var dummyDataFour = []
+	console.log("Testing dummy data");
 
-var dummyDifficultyThree = 70;
-var dummyDataThree = []
+	var dummyDifficultyFour = 90;
+	var dummyDataFour = []
 
-var dummyDifficultyOne = 50;
-var dummyData = []
+	var dummyDifficultyThree = 70;
+	var dummyDataThree = []
 
-var dummyDifficultyTwo = 20;
-var dummyDataTwo = []
+	var dummyDifficultyOne = 50;
+	var dummyData = []
 
+	var dummyDifficultyTwo = 20;
+	var dummyDataTwo = []
 
-for (var i = 0; i < 100; i++){
-	// console.log(raschModel(dummyDifficultyOne,i)*100 + ", ")
 
-	var yVal = (raschModel(dummyDifficultyOne, i) * 100)
+	for (var i = 0; i < 100; i++){
+		// console.log(raschModel(dummyDifficultyOne,i)*100 + ", ")
+
+		var yVal = (raschModel(dummyDifficultyOne, i) * 100)
 	
-	var graphInsert = [parseInt(yVal.toFixed(2)), i];
-	dummyData.push(graphInsert);
-}
+		var graphInsert = [parseInt(yVal.toFixed(2)), i];
+		dummyData.push(graphInsert);
+	}
 
 
 
-for (var i = 0; i < 100; i++){
-	// console.log(raschModel(dummyDifficultyTwo,i)*100 + ", ")
-	var yVal = (raschModel(dummyDifficultyTwo, i) * 100)
+	for (var i = 0; i < 100; i++){
+		// console.log(raschModel(dummyDifficultyTwo,i)*100 + ", ")
+		var yVal = (raschModel(dummyDifficultyTwo, i) * 100)
 	
-	var graphInsert = [parseInt(yVal.toFixed(2)), i];
-	dummyDataTwo.push(graphInsert);
-}
+		var graphInsert = [parseInt(yVal.toFixed(2)), i];
+		dummyDataTwo.push(graphInsert);
+	}
 
 
-for (var i = 0; i < 100; i++){
-	// console.log(raschModel(dummyDifficultyThree,i)*100 + ", ")
-	var yVal = (raschModel(dummyDifficultyThree, i) * 100)
+	for (var i = 0; i < 100; i++){
+		// console.log(raschModel(dummyDifficultyThree,i)*100 + ", ")
+		var yVal = (raschModel(dummyDifficultyThree, i) * 100)
 	
-	var graphInsert = [parseInt(yVal.toFixed(2)), i];
-	dummyDataThree.push(graphInsert);
-}
+		var graphInsert = [parseInt(yVal.toFixed(2)), i];
+		dummyDataThree.push(graphInsert);
+	}
 
 
 
-for (var i = 0; i < 100; i++){
+	for (var i = 0; i < 100; i++){
 
-	console.log(raschModel(dummyDifficultyFour,i)*100 + ", ")
+		console.log(raschModel(dummyDifficultyFour,i)*100 + ", ")
 
-	var yVal = (raschModel(dummyDifficultyFour, i) * 100)
+		var yVal = (raschModel(dummyDifficultyFour, i) * 100)
 	
-	var graphInsert = [parseInt(yVal.toFixed(2)), i];
-	dummyDataFour.push(graphInsert);
-}
-
-// console.log(dummyDataFour)
-
+		var graphInsert = [parseInt(yVal.toFixed(2)), i];
+		dummyDataFour.push(graphInsert);
+	}
 
+	// console.log(dummyDataFour)
 
+}
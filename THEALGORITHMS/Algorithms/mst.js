@@ -0,0 +1,386 @@
+/*
+Multistage Test
+----------------
+mst.js
+
+Multistage (MST) administration for cat.js. Instead of choosing every item,
+the test is a panel of modules, fixed sets of items given as a block, in
+stages:
+
+	stage 1    [ routing ]
+	stage 2    [ easy ] [ medium ] [ hard ]
+	stage 3    [ easy ] [ medium ] [ hard ]
+
+After each module the examinee is routed to a module of the next stage by
+the number of items answered right so far. The routing is worked out once
+when the panel is assembled: for every path through the panel and every
+number correct, the ability at which the path's test characteristic curve
+equals that number correct is found, and the next stage module with the
+most information there is stored in a lookup table. Giving the test is then
+one table read per module.
+
+Modules are given as a characteristic name (every bank item with it, see
+characteristicBitmap in cat.js) or as a list of bank positions.
+
+*/
+
+var path = require('path');
+var itemResponse = require('./itemResponse');
+
+// Ability range searched for routing cut-points, in the model's units
+var THETA_MIN = -4,
+	THETA_MAX = 4;
+
+
+/*
+@moduleItems
+@params cat, module ({ characteristic } or { items })
+
+Bank positions of the items of a module, in bank order.
+
+*/
+
+var moduleItems = function(cat, module){
+	if (module.items) return Uint32Array.from(module.items);
+
+	var bitmap = cat.characteristicBitmap(module.characteristic),
+		items = [];
+	for (var w = 0; w < bitmap.length; w++){
+		for (var bits = bitmap[w]; bits; bits &= bits - 1){
+			items.push(w * 32 + (31 - Math.clz32(bits & -bits)));
+		}
+	}
+	return Uint32Array.from(items);
+}
+
+
+/*
+@pathAbility
+@params a, b, c (parameter columns of the path's items), numberCorrect
+
+Ability at which the expected number correct over the items equals
+numberCorrect, found by bisection within [THETA_MIN, THETA_MAX].
+
+*/
+
+var pathAbility = function(a, b, c, numberCorrect){
+	var lo = THETA_MIN,
+		hi = THETA_MAX;
+
+	for (var step = 0; step < 40; step++){
+		var mid = (lo + hi) / 2,
+			expected = 0;
+		for (var i = 0; i < a.length; i++){
+			expected += itemResponse.logisticProbability(a[i], b[i], c[i], mid);
+		}
+		if (expected < numberCorrect) lo = mid;
+		else hi = mid;
+	}
+	return (lo + hi) / 2;
+}
+
+
+/*
+@moduleInformation
+@params panel, module, theta
+
+Sum of the information of the module's items at theta.
+
+*/
+
+var moduleInformation = function(panel, module, theta){
+	var table = { a: panel.moduleA[module], b: panel.moduleB[module], c: panel.moduleC[module] },
+		total = 0;
+	for (var i = 0; i < table.a.length; i++){
+		total += itemResponse.itemInformation(table, i, theta);
+	}
+	return total;
+}
+
+// Next stage module with the most information at theta
+var bestModule = function(panel, stage, theta){
+	var best = -1,
+		bestInformation = -Infinity;
+	for (var m = panel.stageStart[stage]; m < panel.stageStart[stage + 1]; m++){
+		var information = moduleInformation(panel, m, theta);
+		if (information > bestInformation){
+			best = m;
+			bestInformation = information;
+		}
+	}
+	return best;
+}
+
+
+/*
+@assemblePanel
+@params cat (the cat.js module), options
+	stages    array of stages, each an array of modules; stage 1 has one module
+	model     frozen table the routing is worked out on, default "rasch"
+
+Returns the panel as plain typed arrays (so it can be handed to worker
+threads):
+	moduleItems[m], moduleA/B/C[m]      bank positions and parameters of module m
+	stageStart[s]                       first module of stage s
+	nodeModule, nodeStage, nodeParent   one node per path prefix through the panel
+	routeOffset[node], routes           routes[routeOffset[node] + numberCorrect]
+	                                    is the next node once node's module is done
+
+*/
+
+var assemblePanel = function(cat, options){
+	var table = cat.bankTable(options.model || "rasch"),
+		stages = options.stages,
+		panel = { stages: stages.length, stageStart: new Int32Array(stages.length + 1),
+			moduleItems: [], moduleA: [], moduleB: [], moduleC: [] };
+
+	if (stages[0].length != 1) throw new Error("The first stage of a panel has one module");
+
+	stages.forEach(function(modules, s){
+		panel.stageStart[s] = panel.moduleItems.length;
+		modules.forEach(function(module){
+			var items = moduleItems(cat, module),
+				a = new Float64Array(items.length),
+				b = new Float64Array(items.length),
+				c = new Float64Array(items.length);
+			for (var i = 0; i < items.length; i++){
+				a[i] = table.a[items[i]];
+				b[i] = table.b[items[i]];
+				c[i] = table.c[items[i]];
+			}
+			panel.moduleItems.push(items);
+			panel.moduleA.push(a);
+			panel.moduleB.push(b);
+			panel.moduleC.push(c);
+		});
+	});
+	panel.stageStart[stages.length] = panel.moduleItems.length;
+
+	// Nodes in breadth first order, each with the parameters of every item on
+	// its path so far.
+	var nodeModule = [0], nodeStage = [0], nodeParent = [-1],
+		nodePath = [{ a: panel.moduleA[0], b: panel.moduleB[0], c: panel.moduleC[0] }],
+		routeOffset = [], routes = [];
+
+	for (var node = 0; node < nodeModule.length; node++){
+		var stage = nodeStage[node];
+		routeOffset.push(routes.length);
+		if (stage == stages.length - 1) continue;
+
+		var children = {};
+		for (var m = panel.stageStart[stage + 1]; m < panel.stageStart[stage + 2]; m++){
+			children[m] = nodeModule.length;
+			nodeModule.push(m);
+			nodeStage.push(stage + 1);
+			nodeParent.push(node);
+			nodePath.push(concatPath(nodePath[node], panel, m));
+		}
+
+		var pathItems = nodePath[node];
+		for (var numberCorrect = 0; numberCorrect <= pathItems.a.length; numberCorrect++){
+			var theta = pathAbility(pathItems.a, pathItems.b, pathItems.c, numberCorrect);
+			routes.push(children[bestModule(panel, stage + 1, theta)]);
+		}
+	}
+
+	panel.nodeModule = Int32Array.from(nodeModule);
+	panel.nodeStage = Int32Array.from(nodeStage);
+	panel.nodeParent = Int32Array.from(nodeParent);
+	panel.routeOffset = Int32Array.from(routeOffset);
+	panel.routes = Int32Array.from(routes);
+	return panel;
+}
+
+var concatPath = function(pathItems, panel, module){
+	var join = function(x, y){
+		var joined = new Float64Array(x.length + y.length);
+		joined.set(x);
+		joined.set(y, x.length);
+		return joined;
+	};
+	return {
+		a: join(pathItems.a, panel.moduleA[module]),
+		b: join(pathItems.b, panel.moduleB[module]),
+		c: join(pathItems.c, panel.moduleC[module])
+	};
+}
+
+
+/*
+@createMstRouter
+@params cat, panel (from assemblePanel)
+
+Algorithm that gives the panel in place of item selection: select hands out
+the items of the current module in order, administered counts the number
+correct and routes with one table lookup when the module is done. select
+returns nothing once the last module is done, which ends the test; set the
+test length to at least the longest path. router.route lists the modules
+of the last (or current) candidate's path.
+
+*/
+
+var createMstRouter = function(cat, panel){
+	var node = 0,
+		position = 0,
+		numberCorrect = 0;
+
+	var router = {
+		name: "mstRouter",
+		route: [],
+
+		initialize: function(candidate){
+			node = 0;
+			position = 0;
+			numberCorrect = 0;
+			router.route = [panel.nodeModule[0]];
+		},
+
+		select: function(candidate, D, mask){
+			var items = panel.moduleItems[panel.nodeModule[node]];
+			if (position >= items.length) return undefined;
+			return cat.bankItem(items[position]);
+		},
+
+		administered: function(candidate, item, score, D){
+			var items = panel.moduleItems[panel.nodeModule[node]];
+			if (items[position] != item.index) return;
+
+			numberCorrect += score;
+			if (++position < items.length || panel.nodeStage[node] == panel.stages - 1) return;
+
+			node = panel.routes[panel.routeOffset[node] + numberCorrect];
+			position = 0;
+			router.route.push(panel.nodeModule[node]);
+		},
+
+		saveState: function(candidate){
+			var state = Buffer.alloc(12);
+			state.writeUInt32LE(node, 0);
+			state.writeUInt32LE(position, 4);
+			state.writeUInt32LE(numberCorrect, 8);
+			return state;
+		},
+
+		restoreState: function(candidate, state){
+			node = state.readUInt32LE(0);
+			position = state.readUInt32LE(4);
+			numberCorrect = state.readUInt32LE(8);
+			router.route = [];
+			for (var n = node; n >= 0; n = panel.nodeParent[n]) router.route.unshift(panel.nodeModule[n]);
+		}
+	};
+
+	return router;
+}
+
+
+/*
+@simulateRouting
+@params job (panel, abilities, shard, resultsBuffer)
+
+Routes simulees of the given abilities through the panel, drawing each
+response from the model, and counts per stage how often the module routed
+to is the one with the most information at the simulee's true ability.
+Counts go into the job's shard of the shared results: stage s at
+[shard * (stages + 1) + s], simulees whose whole path was right at
+[shard * (stages + 1) + 0], simulees at the end. Used by mstWorker.js.
+
+*/
+
+var simulateRouting = function(job){
+	var panel = job.panel,
+		stride = panel.stages + 1,
+		results = new Int32Array(job.resultsBuffer),
+		base = job.shard * stride;
+
+	job.abilities.forEach(function(theta){
+		var node = 0,
+			numberCorrect = 0,
+			allRight = true;
+
+		for (var stage = 0; stage < panel.stages; stage++){
+			var module = panel.nodeModule[node];
+			if (stage > 0){
+				if (module == bestModule(panel, stage, theta)) results[base + stage]++;
+				else allRight = false;
+			}
+
+			var a = panel.moduleA[module], b = panel.moduleB[module], c = panel.moduleC[module];
+			for (var i = 0; i < a.length; i++){
+				if (Math.random() < itemResponse.logisticProbability(a[i], b[i], c[i], theta)) numberCorrect++;
+			}
+			if (stage < panel.stages - 1) node = panel.routes[panel.routeOffset[node] + numberCorrect];
+		}
+
+		if (allRight) results[base]++;
+		results[base + stride - 1]++;
+	});
+}
+
+
+/*
+@routingAccuracy
+@params panel, options { abilities, workers }, callback(err, accuracy)
+
+Evaluates a panel offline by simulating the abilities across worker threads
+(mstWorker.js). accuracy.stage[s] is the share of simulees routed to the
+most informative module at stage s (stage 0 is always 1) and accuracy.path
+the share whose every routing decision was right.
+
+*/
+
+var routingAccuracy = function(panel, options, callback){
+	var Worker = require('worker_threads').Worker,
+		abilities = options.abilities,
+		workers = Math.max(1, Math.min(options.workers || 4, abilities.length)),
+		sliceSize = Math.ceil(abilities.length / workers),
+		stride = panel.stages + 1,
+		resultsBuffer = new SharedArrayBuffer(4 * stride * workers),
+		pending = workers,
+		failed = false;
+
+	var finish = function(){
+		var results = new Int32Array(resultsBuffer),
+			totals = new Float64Array(stride);
+		for (var w = 0; w < workers; w++){
+			for (var s = 0; s < stride; s++) totals[s] += results[w * stride + s];
+		}
+
+		var simulees = totals[stride - 1],
+			stage = [1];
+		for (var s = 1; s < panel.stages; s++) stage.push(totals[s] / simulees);
+		callback(null, { simulees: simulees, stage: stage, path: totals[0] / simulees });
+	};
+
+	for (var w = 0; w < workers; w++){
+		var worker = new Worker(path.join(__dirname, 'mstWorker.js'), {
+			workerData: {
+				panel: panel,
+				abilities: abilities.slice(w * sliceSize, (w + 1) * sliceSize),
+				shard: w,
+				resultsBuffer: resultsBuffer
+			}
+		});
+
+		worker.on('error', function(err){
+			if (failed) return;
+			failed = true;
+			callback(err);
+		});
+
+		worker.on('exit', function(){
+			if (--pending == 0 && !failed) finish();
+		});
+	}
+}
+
+
+module.exports = {
+	moduleItems: moduleItems,
+	pathAbility: pathAbility,
+	moduleInformation: moduleInformation,
+	assemblePanel: assemblePanel,
+	createMstRouter: createMstRouter,
+	simulateRouting: simulateRouting,
+	routingAccuracy: routingAccuracy
+};
@@ -0,0 +1,15 @@
+/*
+MST Worker
+----------------
+mstWorker.js
+
+Worker thread entry for routingAccuracy in mst.js. Simulates one slice of
+the abilities through the panel and counts into its shard of the shared
+results.
+
+*/
+
+var workerThreads = require('worker_threads');
+var mst = require('./mst');
+
+mst.simulateRouting(workerThreads.workerData);
@@ -0,0 +1,249 @@
+/*
+Replay
+----------------
+replay.js
+
+Re-runs the adaptive test (cat.js) over sessions recorded by responseLog.js.
+Used as the regression harness for selection and estimation changes and as a
+load generator.
+
+The replay administrator answers each item the way the examinee did in the
+recorded session. When the test picks an item the examinee never saw, the
+answer is simulated from the Rasch model at the examinee's recorded ability,
+with a random number seeded from the examinee and item so that every replay
+of the same log gives the same result.
+
+*/
+
+var fs = require('fs');
+var responseLog = require('./responseLog');
+var itemResponse = require('./itemResponse');
+
+
+/*
+@openResponseLog
+@params paths (segment files, in write order)
+
+Reads every record of the given segments into typed arrays and indexes them
+by (examinee, item). Returns:
+
+	log.length                 number of records
+	log.examinees              examinee ids, in order of first appearance
+	log.response(examinee, item)   recorded score, or -1 if never administered
+	log.ability(examinee)      last recorded ability estimate of the examinee
+
+*/
+
+var openResponseLog = function(paths){
+	var buffers = paths.map(function(p){
+		var buf = fs.readFileSync(p);
+		if (buf.toString('ascii', 0, 4) != "CATL"){
+			throw new Error(p + " is not a response log segment");
+		}
+		if (buf.readUInt16LE(6) != responseLog.RECORD_BYTES){
+			throw new Error(p + ": unexpected record size " + buf.readUInt16LE(6));
+		}
+		return buf;
+	});
+
+	var n = 0;
+	buffers.forEach(function(buf){
+		n += Math.floor((buf.length - responseLog.LOG_HEADER_BYTES) / responseLog.RECORD_BYTES);
+	});
+
+	var examinee = new Uint32Array(n),
+		item = new Uint32Array(n),
+		score = new Int8Array(n),
+		theta = new Float64Array(n),
+		r = 0;
+
+	buffers.forEach(function(buf){
+		var end = buf.length - responseLog.RECORD_BYTES;
+		for (var offset = responseLog.LOG_HEADER_BYTES; offset <= end; offset += responseLog.RECORD_BYTES, r++){
+			examinee[r] = buf.readUInt32LE(offset + 8);
+			item[r] = buf.readUInt32LE(offset + 12);
+			score[r] = buf.readInt32LE(offset + 16);
+			theta[r] = buf.readDoubleLE(offset + 24);
+		}
+	});
+
+	// Sort record numbers by (examinee, item, record) so lookups are a binary
+	// search. For a repeated item the later record sorts last and wins.
+	var order = new Uint32Array(n);
+	for (r = 0; r < n; r++) order[r] = r;
+	order.sort(function(x, y){
+		return (examinee[x] - examinee[y]) || (item[x] - item[y]) || (x - y);
+	});
+
+	var examinees = [],
+		lastRecord = new Map();
+	for (r = 0; r < n; r++){
+		if (!lastRecord.has(examinee[r])) examinees.push(examinee[r]);
+		lastRecord.set(examinee[r], r);
+	}
+
+	var find = function(who, what){
+		var lo = 0,
+			hi = n - 1,
+			found = -1;
+		while (lo <= hi){
+			var mid = (lo + hi) >>> 1,
+				rec = order[mid],
+				cmp = (examinee[rec] - who) || (item[rec] - what);
+			if (cmp < 0) lo = mid + 1;
+			else if (cmp > 0) hi = mid - 1;
+			else { found = rec; lo = mid + 1; }
+		}
+		return found;
+	};
+
+	return {
+		length: n,
+		examinees: examinees,
+
+		response: function(who, what){
+			var rec = find(who, what);
+			return rec < 0 ? -1 : score[rec];
+		},
+
+		ability: function(who){
+			var rec = lastRecord.get(who);
+			return rec == null ? NaN : theta[rec];
+		}
+	};
+}
+
+
+/*
+@seededUniform
+@params examinee, item
+
+Deterministic number in [0, 1) from an examinee id and item index.
+
+*/
+
+var seededUniform = function(examinee, item){
+	var x = (examinee ^ Math.imul(item + 1, 0x9e3779b1)) >>> 0;
+	x = Math.imul(x ^ (x >>> 16), 0x85ebca6b);
+	x = Math.imul(x ^ (x >>> 13), 0xc2b2ae35);
+	x ^= x >>> 16;
+	return (x >>> 0) / 4294967296;
+}
+
+
+/*
+@createReplayAdministrator
+@params log (from openResponseLog)
+
+Algorithm with an administer hook for cat.js. Candidates are
+{ name, examinee } where examinee is the recorded examinee id. Returns the
+item's answer for a recorded right response and "" for a wrong one. Items
+not in the log are simulated with raschModel at log.ability(examinee).
+administrator.replayed and .simulated count both kinds of answer.
+
+*/
+
+var createReplayAdministrator = function(log){
+	var administrator = {
+		name: "replayAdministrator",
+		replayed: 0,
+		simulated: 0,
+
+		administer: function(candidate, item){
+			var who = candidate.examinee == null ? responseLog.hashExaminee(candidate.name) : candidate.examinee,
+				score = log.response(who, item.index);
+
+			if (score >= 0){
+				administrator.replayed++;
+			}
+			else {
+				administrator.simulated++;
+				var P = itemResponse.raschModel(item.difficulty, log.ability(who));
+				score = seededUniform(who, item.index) < P ? 1 : 0;
+			}
+
+			return score == 1 ? item.answer : "";
+		}
+	};
+
+	return administrator;
+}
+
+
+/*
+@replaySessions
+@params cat (the cat.js module), log, options
+	batchSize      sessions per batch, default 1000
+	startAbility   starting D of each session, default 50
+	onBatch(results)   called with the results of each batch
+	done(err, summary) called once every session has been replayed, or with
+	                   the error that stopped the replay
+
+Streams every recorded examinee through cat.newCandidate in batches, giving
+the event loop a turn between batches so a response logger registered on the
+same test keeps committing. Each result is { examinee, measure,
+standardError, itemsTaken, rightAnswers }. Batches after the first run from
+setImmediate, where a throw would crash the process, so an error in any
+batch (or in onBatch) goes to done instead; without done it is thrown.
+
+*/
+
+var replaySessions = function(cat, log, options){
+	var batchSize = options.batchSize || 1000,
+		startAbility = options.startAbility == null ? 50 : options.startAbility,
+		administrator = createReplayAdministrator(log),
+		next = 0,
+		started = Date.now();
+
+	cat.setVerbose(false);
+	cat.registerAlgorithm(administrator);
+
+	var fail = function(err){
+		cat.unregisterAlgorithm(administrator);
+		if (!options.done) throw err;
+		options.done(err);
+	};
+
+	var runBatch = function(){
+		var results = [],
+			end = Math.min(next + batchSize, log.examinees.length);
+
+		try {
+			for (; next < end; next++){
+				var who = log.examinees[next],
+					candidate = cat.acquireCandidate(who, startAbility, who),
+					result = cat.newCandidate(candidate);
+				cat.releaseCandidate(candidate);
+				result.examinee = who;
+				results.push(result);
+			}
+			if (options.onBatch) options.onBatch(results);
+		}
+		catch (err){
+			return fail(err);
+		}
+
+		if (next < log.examinees.length){
+			return setImmediate(runBatch);
+		}
+
+		cat.unregisterAlgorithm(administrator);
+		if (options.done){
+			options.done(null, {
+				sessions: log.examinees.length,
+				replayed: administrator.replayed,
+				simulated: administrator.simulated,
+				milliseconds: Date.now() - started
+			});
+		}
+	};
+
+	runBatch();
+}
+
+
+module.exports = {
+	openResponseLog: openResponseLog,
+	createReplayAdministrator: createReplayAdministrator,
+	replaySessions: replaySessions
+};
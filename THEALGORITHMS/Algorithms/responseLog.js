@@ -0,0 +1,254 @@
+/*
+Response Log
+----------------
+responseLog.js
+
+Append-only binary log of every administered item, for audit and replay.
+The logger is registered on the test like any other algorithm (see
+registerAlgorithm in cat.js) and only copies a fixed width record into an
+in-memory buffer on each administered call. Records are written out in
+groups: one write (and optionally one fdatasync) every flushRecords records
+or flushMs milliseconds, whichever comes first. The writes are asynchronous,
+so the disk never sits on the item selection path.
+
+Each process (or worker thread) owns its own logger and segment files.
+
+Segment file layout (little endian):
+
+	Header (16 bytes)
+		magic           "CATL"
+		version         uint16
+		recordBytes     uint16
+		created         float64  ms since epoch
+
+	Records (32 bytes each)
+		time            float64  ms since epoch
+		examinee        uint32   candidate.examinee, or hashExaminee(candidate.name)
+		item            uint32   bank index of the item
+		response        int32    scored response, 1 right 0 wrong
+		reserved        uint32
+		theta           float64  ability estimate after this response
+
+*/
+
+var fs = require('fs');
+var path = require('path');
+
+var LOG_MAGIC = "CATL",
+	LOG_VERSION = 1,
+	LOG_HEADER_BYTES = 16,
+	RECORD_BYTES = 32;
+
+
+/*
+@hashExaminee
+@params name
+
+32 bit FNV-1a hash of the examinee name, used as the examinee id in records.
+
+*/
+
+var hashExaminee = function(name){
+	var hash = 0x811c9dc5;
+	name = String(name);
+	for (var i = 0; i < name.length; i++){
+		hash ^= name.charCodeAt(i);
+		hash = Math.imul(hash, 0x01000193);
+	}
+	return hash >>> 0;
+}
+
+
+/*
+@segmentName
+@params prefix, n
+
+File name of the n-th segment: prefix-000001.log, prefix-000002.log, ...
+
+*/
+
+var segmentName = function(prefix, n){
+	var digits = String(n);
+	while (digits.length < 6) digits = "0" + digits;
+	return prefix + "-" + digits + ".log";
+}
+
+
+/*
+@lastSegment
+@params dir, prefix
+
+Highest segment number of prefix-NNNNNN.log files already in dir, 0 when
+there are none.
+
+*/
+
+var lastSegment = function(dir, prefix){
+	var highest = 0;
+	fs.readdirSync(dir).forEach(function(file){
+		if (file.slice(0, prefix.length + 1) != prefix + "-" || file.slice(-4) != ".log") return;
+		var digits = file.slice(prefix.length + 1, -4);
+		if (/^[0-9]+$/.test(digits)) highest = Math.max(highest, parseInt(digits, 10));
+	});
+	return highest;
+}
+
+
+/*
+@createResponseLogger
+@params options
+	dir           directory for the segment files (required)
+	prefix        segment file prefix, default "responses"
+	flushRecords  records per group commit, default 256
+	flushMs       longest time a record waits in memory, default 100
+	fdatasync     sync each group commit to disk, default false
+	segmentBytes  start a new segment past this size, default 64 MB
+
+Segments already in dir (an earlier run of the process) are left alone;
+numbering carries on after the highest one.
+
+Returns the logger algorithm:
+	administered(candidate, item, score, theta)
+	flush()                 start a group commit now
+	close(callback)         flush, wait for pending writes and close the files
+
+A closed logger ignores administered, so a logger still registered on the
+test after close does not break the next candidate's test; unregister it to
+take it off the test.
+
+*/
+
+var createResponseLogger = function(options){
+	var dir = options.dir,
+		prefix = path.join(dir, options.prefix || "responses"),
+		flushRecords = options.flushRecords || 256,
+		flushMs = options.flushMs == null ? 100 : options.flushMs,
+		sync = !!options.fdatasync,
+		segmentBytes = options.segmentBytes || 64 * 1024 * 1024,
+		bufferBytes = flushRecords * RECORD_BYTES;
+
+	var segment = null,
+		segmentCount = lastSegment(dir, options.prefix || "responses"),
+		active = Buffer.alloc(bufferBytes),
+		activeBytes = 0,
+		spares = [],
+		writing = 0,
+		closed = false,
+		onDrained = null,
+		firstError = null;
+
+	var openSegment = function(){
+		var header = Buffer.alloc(LOG_HEADER_BYTES),
+			name = segmentName(prefix, ++segmentCount);
+
+		header.write(LOG_MAGIC, 0, 'ascii');
+		header.writeUInt16LE(LOG_VERSION, 4);
+		header.writeUInt16LE(RECORD_BYTES, 6);
+		header.writeDoubleLE(Date.now(), 8);
+
+		var fd = fs.openSync(name, 'wx');
+		fs.writeSync(fd, header, 0, LOG_HEADER_BYTES, 0);
+
+		segment = { fd: fd, name: name, position: LOG_HEADER_BYTES, pending: 0, retired: false, closed: false };
+	};
+
+	var releaseSegment = function(seg){
+		if (seg.retired && seg.pending == 0 && !seg.closed){
+			seg.closed = true;
+			fs.close(seg.fd, function(){});
+		}
+	};
+
+	var writeDone = function(seg, buf){
+		return function(err){
+			if (err && !firstError) firstError = err;
+			seg.pending--;
+			writing--;
+			spares.push(buf);
+			releaseSegment(seg);
+			if (writing == 0 && onDrained) onDrained();
+		};
+	};
+
+	var flush = function(){
+		if (activeBytes == 0) return;
+
+		if (segment.position + activeBytes > segmentBytes && segment.position > LOG_HEADER_BYTES){
+			segment.retired = true;
+			releaseSegment(segment);
+			openSegment();
+		}
+
+		var seg = segment,
+			buf = active,
+			bytes = activeBytes,
+			done = writeDone(seg, buf);
+
+		active = spares.pop() || Buffer.alloc(bufferBytes);
+		activeBytes = 0;
+
+		seg.pending++;
+		writing++;
+		fs.write(seg.fd, buf, 0, bytes, seg.position, function(err){
+			if (err || !sync) return done(err);
+			fs.fdatasync(seg.fd, done);
+		});
+		seg.position += bytes;
+	};
+
+	openSegment();
+
+	var timer = setInterval(flush, flushMs);
+	if (timer.unref) timer.unref();
+
+	var logger = {
+		name: "responseLogger",
+
+		administered: function(candidate, item, score, theta){
+			if (closed) return;
+
+			var offset = activeBytes;
+			active.writeDoubleLE(Date.now(), offset);
+			active.writeUInt32LE(candidate.examinee == null ? hashExaminee(candidate.name) : candidate.examinee, offset + 8);
+			active.writeUInt32LE(item.index, offset + 12);
+			active.writeInt32LE(score, offset + 16);
+			active.writeUInt32LE(0, offset + 20);
+			active.writeDoubleLE(theta, offset + 24);
+			activeBytes += RECORD_BYTES;
+
+			if (activeBytes == bufferBytes) flush();
+		},
+
+		flush: flush,
+
+		close: function(callback){
+			callback = callback || function(err){ if (err) throw err; };
+			if (closed) return callback(firstError);
+
+			closed = true;
+			clearInterval(timer);
+			flush();
+			segment.retired = true;
+
+			var finish = function(){
+				releaseSegment(segment);
+				callback(firstError);
+			};
+
+			if (writing == 0) finish();
+			else onDrained = finish;
+		}
+	};
+
+	return logger;
+}
+
+
+module.exports = {
+	RECORD_BYTES: RECORD_BYTES,
+	LOG_HEADER_BYTES: LOG_HEADER_BYTES,
+	hashExaminee: hashExaminee,
+	segmentName: segmentName,
+	lastSegment: lastSegment,
+	createResponseLogger: createResponseLogger
+};
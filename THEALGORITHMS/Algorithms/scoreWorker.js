@@ -0,0 +1,18 @@
+/*
+Score Worker
+----------------
+scoreWorker.js
+
+Worker thread entry for scoreBatchParallel in itemResponse.js. Scores one
+slice of the response matrix and posts the results back.
+
+*/
+
+var workerThreads = require('worker_threads');
+var itemResponse = require('./itemResponse');
+
+var job = workerThreads.workerData;
+
+workerThreads.parentPort.postMessage(
+	itemResponse.scoreBatch(job.responseMatrix, job.items, job.model, job.estimator)
+);
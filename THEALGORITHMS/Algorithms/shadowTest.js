@@ -0,0 +1,329 @@
+/*
+Shadow Test
+----------------
+shadowTest.js
+
+Blueprint constrained item selection for cat.js. Before every item the
+algorithm assembles a full length "shadow" test that contains every item
+the candidate has already been given, meets the blueprint and is as
+informative as it can be at the current ability estimate. The next item is
+the most informative item of the shadow test not given yet, so the test
+that is actually administered always remains completable within the
+blueprint.
+
+The blueprint is a list of linear constraints over the items of the test:
+
+	{ characteristic: "algebra", min: 3, max: 5 }   items with the characteristic
+	{ characteristic: "enemy-12", max: 1 }          an enemy set
+	{ attribute: "words", min: 200, max: 400 }      sum of item.words
+
+Assembly is a heuristic, not an exact integer program: a greedy fill that
+first reduces blueprint violations and then takes information, followed by
+a swap search (one free item out, one item in) that lowers the violation or
+raises the information. Each selection starts from the previous shadow test,
+which usually needs only the one new slot filled. Both the fill and the swap
+search watch the time budget: the search stops at it, and a fill that runs
+past it (the first selection on a large bank) looks at only part of the bank
+for each remaining slot, so selection latency stays bounded.
+
+*/
+
+var itemResponse = require('./itemResponse');
+
+// Violations smaller than this count as equal when comparing two tests
+var EPSILON = 1e-9;
+
+
+/*
+@createShadowTest
+@params cat (the cat.js module), options
+	testLength    items in the full test (required)
+	constraints   blueprint, see above
+	model         frozen table to take information from, default "rasch"
+	ability(candidate, D)   theta in the model's units, default scaleDifficulty(D)
+	timeBudget    milliseconds of assembly per selection, default 5
+
+Algorithm with a select hook. After each selection shadow.violation holds the
+blueprint violation left in the shadow test (0 when it is met) and
+shadow.swaps the number of swaps the search made.
+
+*/
+
+var createShadowTest = function(cat, options){
+	var testLength = options.testLength,
+		constraints = options.constraints || [],
+		model = options.model || "rasch",
+		timeBudget = options.timeBudget == null ? 5 : options.timeBudget,
+		ability = options.ability || function(candidate, D){
+			return itemResponse.scaleDifficulty(D);
+		},
+		K = constraints.length;
+
+	var lower = new Float64Array(K),
+		upper = new Float64Array(K),
+		sums = new Float64Array(K),
+		// What each item adds to the constraints, sparse: item i's entries are
+		// entryStart[i] up to entryStart[i + 1], in constraint order
+		entryStart = new Uint32Array(1),
+		entryConstraint = new Uint32Array(0),
+		entryWeight = new Float64Array(0),
+		weightsTable = null,
+		weightsLength = -1,
+		information = new Float64Array(0),
+		inTest = new Uint8Array(0),
+		fixed = new Uint8Array(0),
+		eligible = new Uint8Array(0),
+		members = []; // Bank positions in the shadow test, kept as the warm start
+
+	constraints.forEach(function(constraint, k){
+		lower[k] = constraint.min == null ? -Infinity : constraint.min;
+		upper[k] = constraint.max == null ? Infinity : constraint.max;
+	});
+
+	// Calls visit(k, i, weight) for every item with a nonzero weight in
+	// constraint k, constraint by constraint
+	var eachWeight = function(n, visit){
+		constraints.forEach(function(constraint, k){
+			if (constraint.characteristic != null){
+				var bitmap = cat.characteristicBitmap(constraint.characteristic),
+					words = Math.min(bitmap.length, (n + 31) >>> 5);
+				for (var word = 0; word < words; word++){
+					for (var bits = bitmap[word]; bits; bits &= bits - 1){
+						var i = (word << 5) + (31 - Math.clz32(bits & -bits));
+						if (i < n) visit(k, i, 1);
+					}
+				}
+			}
+			else {
+				for (var i = 0; i < n; i++){
+					var w = +cat.bankItem(i)[constraint.attribute] || 0;
+					if (w) visit(k, i, w);
+				}
+			}
+		});
+	};
+
+	// Rebuilds the per item arrays when the bank was replaced or grew
+	var prepare = function(table){
+		var n = table.length;
+		if (table === weightsTable && n == weightsLength) return;
+
+		information = new Float64Array(n);
+		inTest = new Uint8Array(n);
+		fixed = new Uint8Array(n);
+		eligible = new Uint8Array(n);
+
+		var count = new Uint32Array(n + 1),
+			next;
+		eachWeight(n, function(k, i){ count[i + 1]++; });
+		for (var i = 0; i < n; i++) count[i + 1] += count[i];
+		entryStart = count;
+		entryConstraint = new Uint32Array(count[n]);
+		entryWeight = new Float64Array(count[n]);
+		next = count.slice(0, n);
+		eachWeight(n, function(k, i, w){
+			entryConstraint[next[i]] = k;
+			entryWeight[next[i]++] = w;
+		});
+
+		weightsTable = table;
+		weightsLength = n;
+	};
+
+	var violationAt = function(k, value){
+		return value < lower[k] ? lower[k] - value : value > upper[k] ? value - upper[k] : 0;
+	};
+
+	var totalViolation = function(){
+		var total = 0;
+		for (var k = 0; k < K; k++) total += violationAt(k, sums[k]);
+		return total;
+	};
+
+	var addWeights = function(i, sign){
+		for (var e = entryStart[i]; e < entryStart[i + 1]; e++){
+			sums[entryConstraint[e]] += sign * entryWeight[e];
+		}
+	};
+
+	var add = function(i){
+		inTest[i] = 1;
+		members.push(i);
+		addWeights(i, 1);
+	};
+
+	// Change in violation from taking item out (-1 for none) and putting item
+	// in, merging the two items' entries so only the constraints they are in
+	// are looked at
+	var swapChange = function(out, item){
+		var change = 0,
+			a = entryStart[item],
+			aEnd = entryStart[item + 1],
+			b = out < 0 ? 0 : entryStart[out],
+			bEnd = out < 0 ? 0 : entryStart[out + 1];
+		while (a < aEnd || b < bEnd){
+			var k, step;
+			if (b >= bEnd || (a < aEnd && entryConstraint[a] < entryConstraint[b])){
+				k = entryConstraint[a];
+				step = entryWeight[a++];
+			}
+			else if (a >= aEnd || entryConstraint[b] < entryConstraint[a]){
+				k = entryConstraint[b];
+				step = -entryWeight[b++];
+			}
+			else {
+				k = entryConstraint[a];
+				step = entryWeight[a++] - entryWeight[b++];
+			}
+			var value = sums[k],
+				next = value + step;
+			if (next != value) change += violationAt(k, next) - violationAt(k, value);
+		}
+		return change;
+	};
+
+	// Greedy step: the outside item that lowers the violation most, then the
+	// most informative. Returns -1 when no eligible item is left. Past the
+	// deadline a scan ends at the next block of 256 items once it has a
+	// candidate, and the following scan carries on from there, so a fill cut
+	// short still completes the test from a different part of the bank for
+	// every slot.
+	var cursor = 0;
+
+	var bestAddition = function(n, deadline){
+		var best = -1,
+			bestChange = Infinity;
+		for (var s = 0; s < n; s++){
+			var i = cursor + s < n ? cursor + s : cursor + s - n;
+			if ((s & 255) == 255 && best >= 0 && Date.now() > deadline){
+				cursor = i;
+				break;
+			}
+			if (inTest[i] || !eligible[i]) continue;
+			var change = swapChange(-1, i);
+			if (change < bestChange - EPSILON ||
+				(change < bestChange + EPSILON && information[i] > information[best])){
+				best = i;
+				bestChange = change;
+			}
+		}
+		return best;
+	};
+
+	// Swap search, first improvement, until no swap helps or time runs out.
+	// A swap must lower the violation, or keep it and raise the information,
+	// so every swap improves the test and the search cannot cycle.
+	var improve = function(n, deadline){
+		var improved = true;
+
+		while (improved){
+			if (Date.now() > deadline) return;
+			improved = false;
+			for (var i = 0; i < n; i++){
+				if ((i & 255) == 255 && Date.now() > deadline) return;
+				if (inTest[i] || !eligible[i]) continue;
+
+				// Member whose swap for i changes the violation least, the least
+				// informative one among equals
+				var bestSlot = -1,
+					bestChange = Infinity;
+				for (var m = 0; m < members.length; m++){
+					var out = members[m];
+					if (fixed[out]) continue;
+					var change = swapChange(out, i);
+					if (change < bestChange - EPSILON ||
+						(change < bestChange + EPSILON && information[out] < information[members[bestSlot]])){
+						bestSlot = m;
+						bestChange = change;
+					}
+				}
+				if (bestSlot < 0) continue;
+
+				var removed = members[bestSlot];
+				if (!(bestChange < -EPSILON ||
+					(bestChange < EPSILON && information[i] > information[removed]))) continue;
+
+				addWeights(i, 1);
+				addWeights(removed, -1);
+				inTest[removed] = 0;
+				inTest[i] = 1;
+				members[bestSlot] = i;
+				shadowTest.swaps++;
+				improved = true;
+			}
+		}
+	};
+
+	var shadowTest = {
+		name: "shadowTest",
+		violation: 0,
+		swaps: 0,
+
+		initialize: function(candidate){
+			members.length = 0;
+		},
+
+		select: function(candidate, D, mask){
+			var table = cat.bankTable(model),
+				n = table.length,
+				theta = ability(candidate, D),
+				deadline = Date.now() + timeBudget,
+				given = cat.administeredItems(),
+				i;
+
+			prepare(table);
+
+			for (i = 0; i < n; i++){
+				information[i] = itemResponse.itemInformation(table, i, theta);
+				eligible[i] = (mask && !(mask[i >>> 5] & (1 << (i & 31)))) || cat.isRetired(i) ? 0 : 1;
+			}
+			inTest.fill(0);
+			fixed.fill(0);
+			sums.fill(0);
+			shadowTest.swaps = 0;
+
+			// Items already given are in the shadow test whatever the blueprint
+			// says, then the previous shadow test as far as it is still usable.
+			var previous = cat.scratch(members.length);
+			for (var p = 0; p < members.length; p++) previous[p] = members[p];
+			members.length = 0;
+			for (var g = 0; g < given.length; g++){
+				if (!inTest[given[g]]) add(given[g]);
+				fixed[given[g]] = 1;
+			}
+			for (p = 0; p < previous.length && members.length < testLength; p++){
+				if (!inTest[previous[p]] && eligible[previous[p]]) add(previous[p]);
+			}
+			cursor = 0;
+			while (members.length < testLength){
+				var next = bestAddition(n, deadline);
+				if (next < 0) break;
+				add(next);
+			}
+
+			improve(n, deadline);
+			shadowTest.violation = totalViolation();
+
+			// Most informative free item of the shadow test the approve hooks accept
+			var free = cat.scratch(members.length),
+				freeCount = 0;
+			for (var m = 0; m < members.length; m++){
+				if (!fixed[members[m]]) free[freeCount++] = members[m];
+			}
+			free = free.subarray(0, freeCount).sort(function(x, y){ return information[y] - information[x]; });
+			for (var f = 0; f < freeCount; f++){
+				var item = cat.bankItem(free[f]);
+				if (cat.approveItem(candidate, item)) return item;
+			}
+
+			return cat.selectItem(D, candidate);
+		}
+	};
+
+	return shadowTest;
+}
+
+
+module.exports = {
+	createShadowTest: createShadowTest
+};
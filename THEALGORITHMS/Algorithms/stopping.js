@@ -0,0 +1,370 @@
+/*
+Stopping
+----------------
+stopping.js
+
+Variable length tests for cat.js. The test normally runs for its full
+length (setTestLength); a stopping rule registered as an algorithm ends it
+as soon as the ability estimate is precise enough.
+
+Precision comes from the test information, the sum of the information of
+the items given. Recomputing it over every item at each new estimate costs
+one pass over the test per response, so it is kept as a running sum
+instead: each item adds its information at the estimate updated by its own
+response (the D cat.js passes to administered), and earlier items are not
+revisited when the estimate moves on. The information accumulator is
+shared, one per cat module and model, so every algorithm that wants the
+test information (stopping rules, information based selection) reads the
+same sum.
+
+*/
+
+var itemResponse = require('./itemResponse');
+
+
+/*
+@informationAccumulator
+@params cat (the cat.js module), options
+	model     frozen table to take information from, default "rasch"
+	ability(candidate, D)   theta in the model's units, default scaleDifficulty(D)
+
+Returns the running test information for the model, registering it on the
+test the first time it is asked for; later calls get the same accumulator
+for as long as it stays registered (cat.findAlgorithm). Asking for it with a
+different ability function throws. After each administered item:
+	accumulator.information   test information so far
+	accumulator.gain          information the last item added, at theta
+	accumulator.theta         estimate after the last response, in the model's units
+	accumulator.thetaChange   change of the estimate from the last item
+	accumulator.items         items counted
+
+*/
+
+var scaledAbility = function(candidate, D){
+	return itemResponse.scaleDifficulty(D);
+}
+
+var informationAccumulator = function(cat, options){
+	options = options || {};
+	var model = options.model || "rasch",
+		ability = options.ability || scaledAbility,
+		name = "informationAccumulator-" + model;
+
+	var shared = cat.findAlgorithm(name);
+	if (shared){
+		if (shared.ability !== ability){
+			throw new Error(name + " is already registered with a different ability");
+		}
+		return shared;
+	}
+
+	var accumulator = {
+		name: name,
+		model: model,
+		ability: ability,
+		information: 0,
+		gain: 0,
+		theta: NaN,
+		thetaChange: Infinity,
+		items: 0,
+
+		initialize: function(candidate){
+			accumulator.information = 0;
+			accumulator.gain = 0;
+			accumulator.theta = NaN;
+			accumulator.thetaChange = Infinity;
+			accumulator.items = 0;
+		},
+
+		administered: function(candidate, item, score, D){
+			var theta = ability(candidate, D);
+
+			accumulator.gain = itemResponse.itemInformation(cat.bankTable(model), item.index, theta);
+			accumulator.information += accumulator.gain;
+			accumulator.thetaChange = isNaN(accumulator.theta) ? Infinity : Math.abs(theta - accumulator.theta);
+			accumulator.theta = theta;
+			accumulator.items++;
+		},
+
+		saveState: function(candidate){
+			var state = Buffer.alloc(36);
+			state.writeDoubleLE(accumulator.information, 0);
+			state.writeDoubleLE(accumulator.gain, 8);
+			state.writeDoubleLE(accumulator.theta, 16);
+			state.writeDoubleLE(accumulator.thetaChange, 24);
+			state.writeUInt32LE(accumulator.items, 32);
+			return state;
+		},
+
+		restoreState: function(candidate, state){
+			accumulator.information = state.readDoubleLE(0);
+			accumulator.gain = state.readDoubleLE(8);
+			accumulator.theta = state.readDoubleLE(16);
+			accumulator.thetaChange = state.readDoubleLE(24);
+			accumulator.items = state.readUInt32LE(32);
+		}
+	};
+
+	cat.registerAlgorithm(accumulator);
+	return accumulator;
+}
+
+
+/*
+@createStoppingRule
+@params cat, options
+	standardError    stop once 1 / sqrt(information) is at or below this
+	informationGain  stop once an item adds less information than this
+	thetaChange      stop once the estimate moves less than this
+	minItems         never stop before this many items, default 1
+	model, ability   passed on to informationAccumulator
+
+Algorithm with a stop hook. Any threshold that is met ends the test; leave a
+threshold out to not use it. rule.reason names the threshold that stopped
+the last test, or is null when it ran its full length.
+
+*/
+
+var createStoppingRule = function(cat, options){
+	var accumulator = informationAccumulator(cat, options),
+		minItems = options.minItems == null ? 1 : options.minItems;
+
+	var rule = {
+		name: "stoppingRule",
+		accumulator: accumulator,
+		reason: null,
+
+		initialize: function(candidate){
+			rule.reason = null;
+		},
+
+		stop: function(candidate){
+			rule.reason = null;
+			if (accumulator.items < minItems) return false;
+
+			if (options.standardError != null &&
+				1 / Math.sqrt(accumulator.information) <= options.standardError){
+				rule.reason = "standardError";
+			}
+			else if (options.informationGain != null && accumulator.gain < options.informationGain){
+				rule.reason = "informationGain";
+			}
+			else if (options.thetaChange != null && accumulator.thetaChange < options.thetaChange){
+				rule.reason = "thetaChange";
+			}
+			return rule.reason != null;
+		},
+
+		// Nothing to keep: the decision is made from the accumulator (which is
+		// checkpointed itself) on every call. The hooks only clear the reason a
+		// finished test left behind when a session is resumed.
+		saveState: function(candidate){
+			return Buffer.alloc(0);
+		},
+
+		restoreState: function(candidate, state){
+			rule.reason = null;
+		}
+	};
+
+	return rule;
+}
+
+
+/*
+@createClassificationRule
+@params cat, options
+	cut            pass / fail cut score, in the model's units (required)
+	delta          half width of the indifference region, default 0.2
+	alpha, beta    error rates of the decision, default 0.05
+	glr            use the generalized likelihood ratio, default false
+	curtail        end the test once the decision can no longer change
+	maxItems       test length, needed for curtailment
+	minItems       never stop before this many items, default 1
+	model          frozen table the likelihoods come from, default "rasch"
+
+Sequential probability ratio test around the cut. The log likelihood ratio
+of cut + delta against cut - delta is kept as a running sum: each item adds
+log(P+ / P-) when right and log((1 - P+) / (1 - P-)) when wrong, and both
+are tabulated per bank item when the rule first sees the bank, so an update
+is one table read. The test stops once the ratio leaves
+[log(beta / (1 - alpha)), log((1 - beta) / alpha)].
+
+With glr the ratio is between the highest likelihoods above cut + delta and
+below cut - delta instead of at the two points, taken over a fixed theta
+grid whose log likelihoods are updated by each response.
+
+With curtail (SPRT only, it cannot be combined with glr) the rule also
+keeps, for r items to go, the largest rise and the largest fall the ratio
+could still make (the r biggest right and wrong contributions in the bank,
+precomputed with the table). Once the ratio cannot cross zero in the items
+left, the final decision is known and the test ends.
+
+rule.decision is "pass" or "fail" by the sign of the ratio so far,
+rule.ratio the ratio and rule.reason why the test stopped ("sprt", "glr" or
+"curtailed"), null when it ran its full length.
+
+*/
+
+var GRID_STEP = 0.05;
+
+var createClassificationRule = function(cat, options){
+	var model = options.model || "rasch",
+		cut = options.cut,
+		delta = options.delta == null ? 0.2 : options.delta,
+		alpha = options.alpha == null ? 0.05 : options.alpha,
+		beta = options.beta == null ? 0.05 : options.beta,
+		minItems = options.minItems == null ? 1 : options.minItems,
+		upperBound = Math.log((1 - beta) / alpha),
+		lowerBound = Math.log(beta / (1 - alpha)),
+		low = cut - delta,
+		high = cut + delta;
+
+	if (options.curtail && options.maxItems == null){
+		throw new Error("Curtailment needs maxItems");
+	}
+	if (options.curtail && options.glr){
+		throw new Error("Curtailment is only available for the SPRT, not with glr");
+	}
+
+	var tableSeen = null,
+		tableLength = -1,
+		ratioRight = new Float64Array(0), // Per bank item, added when right
+		ratioWrong = new Float64Array(0), // and when wrong
+		mostRise = new Float64Array(0), // [r] largest rise over r more items
+		mostFall = new Float64Array(0);
+
+	// GLR grid: log likelihood at each theta, the points up to lowEnd lie at
+	// or below cut - delta and those from highStart at or above cut + delta.
+	var grid = [low, high];
+	for (var theta = -4; theta <= 4 + 1e-9; theta += GRID_STEP){
+		if (theta < low || theta > high) grid.push(theta);
+	}
+	grid.sort(function(x, y){ return x - y; });
+	grid = Float64Array.from(grid);
+	var lowEnd = grid.indexOf(low),
+		highStart = grid.indexOf(high),
+		logLikelihood = new Float64Array(grid.length);
+
+	var prepare = function(){
+		var table = cat.bankTable(model),
+			n = table.length;
+		if (table === tableSeen && n == tableLength) return table;
+
+		ratioRight = new Float64Array(n);
+		ratioWrong = new Float64Array(n);
+		for (var i = 0; i < n; i++){
+			var pLow = itemResponse.tableProbability(table, i, low),
+				pHigh = itemResponse.tableProbability(table, i, high);
+			ratioRight[i] = Math.log(pHigh / pLow);
+			ratioWrong[i] = Math.log((1 - pHigh) / (1 - pLow));
+		}
+
+		if (options.curtail){
+			var rises = Float64Array.from(ratioRight).sort().reverse(),
+				falls = Float64Array.from(ratioWrong).sort(),
+				length = Math.min(options.maxItems, n);
+			mostRise = new Float64Array(length + 1);
+			mostFall = new Float64Array(length + 1);
+			for (var r = 1; r <= length; r++){
+				mostRise[r] = mostRise[r - 1] + Math.max(0, rises[r - 1]);
+				mostFall[r] = mostFall[r - 1] + Math.max(0, -falls[r - 1]);
+			}
+		}
+
+		tableSeen = table;
+		tableLength = n;
+		return table;
+	};
+
+	var rule = {
+		name: "classificationRule",
+		ratio: 0,
+		decision: null,
+		reason: null,
+		items: 0,
+
+		initialize: function(candidate){
+			prepare();
+			rule.ratio = 0;
+			rule.decision = null;
+			rule.reason = null;
+			rule.items = 0;
+			logLikelihood.fill(0);
+		},
+
+		administered: function(candidate, item, score, D){
+			var table = prepare(),
+				i = item.index;
+
+			rule.items++;
+			if (!options.glr){
+				rule.ratio += score == 1 ? ratioRight[i] : ratioWrong[i];
+			}
+			else {
+				var lowBest = -Infinity,
+					highBest = -Infinity;
+				for (var g = 0; g < grid.length; g++){
+					var P = itemResponse.tableProbability(table, i, grid[g]);
+					logLikelihood[g] += Math.log(score == 1 ? P : 1 - P);
+					if (g <= lowEnd) lowBest = Math.max(lowBest, logLikelihood[g]);
+					if (g >= highStart) highBest = Math.max(highBest, logLikelihood[g]);
+				}
+				rule.ratio = highBest - lowBest;
+			}
+			rule.decision = rule.ratio >= 0 ? "pass" : "fail";
+		},
+
+		stop: function(candidate){
+			rule.reason = null;
+			if (rule.items < minItems) return false;
+
+			if (rule.ratio >= upperBound || rule.ratio <= lowerBound){
+				rule.reason = options.glr ? "glr" : "sprt";
+			}
+			else if (options.curtail){
+				var left = Math.max(0, Math.min(options.maxItems - rule.items, mostRise.length - 1));
+				if (rule.ratio - mostFall[left] >= 0 || rule.ratio + mostRise[left] < 0){
+					rule.reason = "curtailed";
+				}
+			}
+			return rule.reason != null;
+		},
+
+		// ratio, items, then the GLR grid's log likelihoods (glr only)
+		saveState: function(candidate){
+			var state = Buffer.alloc(12 + (options.glr ? 8 * logLikelihood.length : 0));
+			state.writeDoubleLE(rule.ratio, 0);
+			state.writeUInt32LE(rule.items, 8);
+			if (options.glr){
+				for (var g = 0; g < logLikelihood.length; g++){
+					state.writeDoubleLE(logLikelihood[g], 12 + 8 * g);
+				}
+			}
+			return state;
+		},
+
+		restoreState: function(candidate, state){
+			prepare();
+			rule.ratio = state.readDoubleLE(0);
+			rule.items = state.readUInt32LE(8);
+			logLikelihood.fill(0);
+			if (options.glr){
+				for (var g = 0; g < logLikelihood.length; g++){
+					logLikelihood[g] = state.readDoubleLE(12 + 8 * g);
+				}
+			}
+			rule.decision = rule.items == 0 ? null : rule.ratio >= 0 ? "pass" : "fail";
+			rule.reason = null;
+		}
+	};
+
+	return rule;
+}
+
+
+module.exports = {
+	informationAccumulator: informationAccumulator,
+	createStoppingRule: createStoppingRule,
+	createClassificationRule: createClassificationRule
+};
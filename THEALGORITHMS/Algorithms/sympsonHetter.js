@@ -0,0 +1,206 @@
+/*
+Sympson-Hetter
+----------------
+sympsonHetter.js
+
+Sympson-Hetter exposure control for cat.js. Every item i has an exposure
+parameter K[i] in [0, 1]. When the test selects item i it is only given with
+probability K[i]; otherwise it is passed over for the rest of that
+candidate's test and the next closest item is tried.
+
+The K[i] come from calibrateSympsonHetter, which simulates a target
+population again and again and lowers K[i] for every item selected more often
+than the target maximum exposure rate:
+
+	P(S[i]) = selections of i / examinees
+	K[i] = rMax / P(S[i])   if P(S[i]) > rMax
+	K[i] = 1                otherwise
+
+Each iteration's examinees are split across worker threads
+(calibrateWorker.js) that record into shards of shared exposure counters.
+
+*/
+
+var path = require('path');
+var exposure = require('./exposure');
+var itemResponse = require('./itemResponse');
+
+
+/*
+@createSympsonHetter
+@params K (array of exposure parameters by bank position), options
+	selected   exposure counter to record selections into (optional)
+	random     function returning [0, 1), default Math.random
+
+Algorithm with approve and initialize hooks. Items without a K (added to the
+bank later) are always approved.
+
+*/
+
+var createSympsonHetter = function(K, options){
+	options = options || {};
+
+	var random = options.random || Math.random,
+		rejected = new Uint8Array(K.length),
+		touched = [];
+
+	return {
+		name: "sympsonHetter",
+		K: K,
+
+		initialize: function(candidate){
+			for (var t = 0; t < touched.length; t++) rejected[touched[t]] = 0;
+			touched.length = 0;
+		},
+
+		approve: function(candidate, item){
+			var i = item.index;
+			if (i >= K.length) return true;
+			if (rejected[i]) return false;
+
+			if (options.selected) options.selected.administered(candidate, item);
+			if (random() < K[i]) return true;
+
+			rejected[i] = 1;
+			touched.push(i);
+			return false;
+		}
+	};
+}
+
+
+/*
+@simulateExposure
+@params job { items, abilities, K, testLength, shards, shard, selectedBuffer, administeredBuffer }
+
+Runs one slice of a calibration iteration in this thread: every ability in
+job.abilities takes the test with Sympson-Hetter on, answering from the
+Rasch model. Selections and administrations go into shard job.shard of the
+two shared counters. Used by calibrateWorker.js.
+
+*/
+
+var simulateExposure = function(job){
+	var cat = require('./cat'),
+		n = job.items.length,
+		selected = exposure.openExposureCounter(job.selectedBuffer, n, job.shards, job.shard),
+		administered = exposure.openExposureCounter(job.administeredBuffer, n, job.shards, job.shard),
+		control = createSympsonHetter(job.K, { selected: selected });
+
+	var simulator = {
+		administer: function(candidate, item){
+			var P = itemResponse.raschModel(item.difficulty, candidate.ability);
+			return Math.random() < P ? item.answer : "";
+		}
+	};
+
+	cat.setVerbose(false);
+	cat.useItemBank(job.items);
+	if (job.testLength) cat.setTestLength(job.testLength);
+	// selected is only fed by the approve hook, so it is not registered itself
+	[administered, control, simulator].forEach(cat.registerAlgorithm);
+
+	try {
+		for (var e = 0; e < job.abilities.length; e++){
+			var candidate = cat.acquireCandidate("simulee" + e, job.abilities[e]);
+			selected.initialize(candidate);
+			cat.newCandidate(candidate);
+			cat.releaseCandidate(candidate);
+		}
+	}
+	finally {
+		[administered, control, simulator].forEach(cat.unregisterAlgorithm);
+	}
+}
+
+
+/*
+@calibrateSympsonHetter
+@params items, options, callback(err, result)
+	abilities    simulated population, one starting ability per examinee (required)
+	rMax         target maximum exposure rate, default 0.25
+	iterations   most iterations to run, default 20
+	tolerance    stop once every exposure rate is within rMax + tolerance, default 0.01
+	workers      worker threads per iteration, default 4
+	testLength   test length for the simulation (see setTestLength in cat.js)
+
+result is { K, maxExposure, iterations }. K is a Float64Array by bank
+position, ready for createSympsonHetter.
+
+*/
+
+var calibrateSympsonHetter = function(items, options, callback){
+	var Worker = require('worker_threads').Worker,
+		n = items.length,
+		abilities = options.abilities,
+		rMax = options.rMax || 0.25,
+		iterations = options.iterations || 20,
+		tolerance = options.tolerance == null ? 0.01 : options.tolerance,
+		workers = Math.max(1, Math.min(options.workers || 4, abilities.length)),
+		sliceSize = Math.ceil(abilities.length / workers),
+		K = new Float64Array(n).fill(1),
+		iteration = 0;
+
+	// Plain copies of the items, worker threads cannot share the objects.
+	var bankItems = items.map(function(item){
+		return { question: item.question, answer: item.answer, difficulty: item.difficulty };
+	});
+
+	var runIteration = function(){
+		var selected = exposure.createExposureCounter({ items: n, shards: workers }),
+			administered = exposure.createExposureCounter({ items: n, shards: workers }),
+			pending = workers,
+			failed = false;
+
+		iteration++;
+
+		for (var w = 0; w < workers; w++){
+			var worker = new Worker(path.join(__dirname, 'calibrateWorker.js'), {
+				workerData: {
+					items: bankItems,
+					abilities: abilities.slice(w * sliceSize, (w + 1) * sliceSize),
+					K: K,
+					testLength: options.testLength,
+					shards: workers,
+					shard: w,
+					selectedBuffer: selected.buffer,
+					administeredBuffer: administered.buffer
+				}
+			});
+
+			worker.on('error', function(err){
+				if (failed) return;
+				failed = true;
+				callback(err);
+			});
+
+			worker.on('exit', function(){
+				if (--pending == 0 && !failed) finishIteration(selected, administered);
+			});
+		}
+	};
+
+	var finishIteration = function(selected, administered){
+		var maxExposure = 0;
+
+		for (var i = 0; i < n; i++){
+			var selectionRate = selected.rate(i);
+			K[i] = selectionRate > rMax ? rMax / selectionRate : 1;
+			maxExposure = Math.max(maxExposure, administered.rate(i));
+		}
+
+		if (maxExposure <= rMax + tolerance || iteration >= iterations){
+			return callback(null, { K: K, maxExposure: maxExposure, iterations: iteration });
+		}
+		runIteration();
+	};
+
+	runIteration();
+}
+
+
+module.exports = {
+	createSympsonHetter: createSympsonHetter,
+	simulateExposure: simulateExposure,
+	calibrateSympsonHetter: calibrateSympsonHetter
+};
@@ -0,0 +1,938 @@
+/*
+Tests
+----------------
+test.js
+
+Behaviour checks for the algorithms, run with node test.js. Plain asserts,
+no test framework; the process exits with 1 if any check fails.
+
+*/
+
+var assert = require('assert');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+
+var cat = require('./cat');
+var itemResponse = require('./itemResponse');
+var itemBank = require('./itemBank');
+var shadowTest = require('./shadowTest');
+var diagnosis = require('./diagnosis');
+var stopping = require('./stopping');
+var responseLog = require('./responseLog');
+var replay = require('./replay');
+var exposure = require('./exposure');
+var content = require('./content');
+var mst = require('./mst');
+
+var failures = 0;
+
+var check = function(name, test){
+	try {
+		test();
+		console.log("ok      " + name);
+	}
+	catch (err){
+		failures++;
+		console.log("FAILED  " + name + "\n        " + err.message);
+	}
+}
+
+var tempDir = fs.mkdtempSync(path.join(os.tmpdir(), "cat-test-"));
+
+// Bank of n random items for every model, seeded so runs are repeatable
+var seed = 12345;
+var random = function(){
+	seed = (Math.imul(seed, 1103515245) + 12345) >>> 0;
+	return seed / 4294967296;
+}
+
+var randomBank = function(n){
+	var items = [];
+	for (var i = 0; i < n; i++){
+		var model = ["rasch", "2pl", "3pl"][i % 3];
+		items.push({
+			question: "q" + i,
+			answer: "a",
+			model: model,
+			difficulty: model == "rasch" ? 1 + random() * 99 : random() * 6 - 3,
+			discrimination: 0.3 + random() * 2,
+			psuedoChance: model == "3pl" ? random() * 0.3 : 0,
+			characteristics: ["area" + (i % 4)]
+		});
+	}
+	return items;
+}
+
+var simpleBank = function(n){
+	var items = [];
+	for (var i = 0; i < n; i++){
+		items.push({ question: "q" + i, answer: "1", difficulty: 1 + (i * 37) % 100 });
+	}
+	return items;
+}
+
+cat.setVerbose(false);
+
+
+// Precision contract (checkTablePrecision, float32 banks) ===================
+
+check("float32 tables stay within FLOAT32_TOLERANCE on random banks", function(){
+	for (var bank = 0; bank < 5; bank++){
+		var items = randomBank(300);
+		["rasch", "2pl", "3pl"].forEach(function(model){
+			var result = itemResponse.checkTablePrecision(items, model);
+			assert.ok(result.ok, model + " max error " + result.maxError);
+		});
+	}
+});
+
+check("float32 bank file round trip keeps probabilities within tolerance", function(){
+	var items = randomBank(500),
+		file = path.join(tempDir, "bank32.catb");
+	itemBank.writeBankFile(file, items, { precision: "float32" });
+
+	var bank = itemBank.openBankFile(file);
+	assert.strictEqual(bank.precision, "float32");
+	assert.strictEqual(bank.length, items.length);
+
+	var read = [];
+	for (var i = 0; i < bank.length; i++) read.push(bank.item(i));
+
+	["rasch", "2pl", "3pl"].forEach(function(model){
+		var full = itemResponse.freezeItemTable(items, model),
+			single = itemResponse.freezeItemTable(read, model);
+		for (var i = 0; i < items.length; i++){
+			for (var t = -40; t <= 40; t += 5){
+				var error = Math.abs(itemResponse.tableProbability(single, i, t / 10) -
+					itemResponse.tableProbability(full, i, t / 10));
+				assert.ok(error <= itemResponse.FLOAT32_TOLERANCE, model + " item " + i + " error " + error);
+			}
+		}
+	});
+});
+
+
+// Estimation =================================================================
+
+check("EAP stays finite on long response vectors and agrees with MLE", function(){
+	var items = [];
+	for (var i = 0; i < 1200; i++) items.push({ difficulty: random() * 4 - 2, discrimination: 0.8 + random() });
+	var table = itemResponse.freezeItemTable(items, "2pl"),
+		responses = [];
+	for (i = 0; i < items.length; i++){
+		responses.push(random() < itemResponse.tableProbability(table, i, 0.5) ? 1 : 0);
+	}
+
+	var eap = itemResponse.estimateAbility(responses, table, "EAP"),
+		mle = itemResponse.estimateAbility(responses, table, "MLE");
+	assert.ok(isFinite(eap.theta) && isFinite(eap.standardError));
+	assert.ok(Math.abs(eap.theta - mle.theta) < 0.02, eap.theta + " vs " + mle.theta);
+	assert.ok(Math.abs(eap.standardError - mle.standardError) < 0.01, eap.standardError + " vs " + mle.standardError);
+});
+
+
+// Names =====================================================================
+
+check("names shared with Object.prototype work as keys", function(){
+	assert.strictEqual(typeof cat.thetaSlot("toString"), "number");
+
+	var file = path.join(tempDir, "names.catb");
+	itemBank.writeBankFile(file, [{ question: "q", answer: "a", difficulty: 5, characteristics: ["constructor"] }]);
+	assert.deepStrictEqual(itemBank.openBankFile(file).item(0).characteristics, ["constructor"]);
+});
+
+check("a bank file records the difficulty scale in use", function(){
+	var file = path.join(tempDir, "scale.catb");
+	itemResponse.setDifficultyScale([0, 200]);
+	try {
+		itemBank.writeBankFile(file, simpleBank(3));
+	}
+	finally {
+		itemResponse.setDifficultyScale([1, 100]);
+	}
+	assert.deepStrictEqual(itemBank.openBankFile(file).scale, [0, 200]);
+
+	itemBank.writeBankFile(file, simpleBank(3), { scale: [10, 20] });
+	assert.deepStrictEqual(itemBank.openBankFile(file).scale, [10, 20]);
+});
+
+check("an opened bank file runs a test without building every item", function(){
+	var items = simpleBank(2000),
+		file = path.join(tempDir, "lazy.catb");
+	items.forEach(function(item, i){ item.characteristics = ["area" + (i % 4)]; });
+	itemBank.writeBankFile(file, items);
+
+	var bank = itemBank.openBankFile(file),
+		built = 0,
+		item = bank.item;
+	bank.item = function(i){ built++; return item(i); };
+
+	var given = [],
+		answers = { administer: function(candidate, item){ given.push(item.question); return item.answer; } },
+		filter = { filter: function(candidate, mask){
+			var area = cat.characteristicBitmap("area1");
+			for (var w = 0; w < mask.length; w++) mask[w] &= area[w] || 0;
+		} };
+	cat.registerAlgorithm(answers);
+	cat.registerAlgorithm(filter);
+
+	try {
+		cat.setTestLength(9);
+		cat.useItemBank(bank);
+		cat.newCandidate({ name: "lazy", ability: 50 });
+		var fromFile = given.slice();
+		assert.ok(built < 100, built + " items built");
+
+		given.length = 0;
+		cat.useItemBank(items);
+		cat.newCandidate({ name: "lazy", ability: 50 });
+		assert.deepStrictEqual(fromFile, given);
+	}
+	finally {
+		cat.unregisterAlgorithm(answers);
+		cat.unregisterAlgorithm(filter);
+	}
+});
+
+
+// Text tables ================================================================
+
+check("table errors report the line number in the file", function(){
+	var file = path.join(tempDir, "items.tsv");
+	fs.writeFileSync(file, "question\tanswer\tdifficulty\nq1\ta\t5\n\nq2\ta\tbad\n");
+	var result = itemBank.loadItemTable(file, { delimiter: "\t" });
+	assert.strictEqual(result.items.length, 1);
+	assert.strictEqual(result.errors[0].row, 4);
+});
+
+
+// Selection =================================================================
+
+// Closest item to D by a walk over the whole bank, ties to the earliest
+var closestByScan = function(items, D, skip){
+	var best;
+	items.forEach(function(item){
+		if (skip && skip(item)) return;
+		if (!best || Math.abs(item.difficulty - D) < Math.abs(best.difficulty - D)) best = item;
+	});
+	return best;
+}
+
+check("findItemInBank picks the same items as a scan of the bank", function(){
+	for (var bank = 0; bank < 20; bank++){
+		var items = [];
+		for (var i = 0; i < 200; i++) items.push({ question: "q" + i, difficulty: 1 + Math.floor(random() * 100) });
+		cat.useItemBank(items);
+		for (var t = 0; t < 50; t++){
+			// Half way between two difficulties half the time, to exercise ties
+			var D = t % 2 ? random() * 110 - 5 : Math.floor(random() * 100) + 0.5;
+			assert.strictEqual(cat.findItemInBank(D), closestByScan(items, D), "D " + D);
+		}
+	}
+});
+
+check("findItemInBank stays right through random adds and retirements", function(){
+	var items = [];
+	for (var i = 0; i < 50; i++) items.push({ question: "q" + i, difficulty: 1 + Math.floor(random() * 100) });
+	cat.useItemBank(items);
+	var live = items.slice();
+
+	for (var step = 0; step < 500; step++){
+		if (random() < 0.5 || live.length < 2){
+			var item = { question: "added" + step, difficulty: 1 + Math.floor(random() * 100) };
+			cat.addItem(item);
+			live.push(item);
+		}
+		else {
+			var retired = live.splice(Math.floor(random() * live.length), 1)[0];
+			cat.retireItem(retired);
+			assert.ok(cat.isRetired(retired.index));
+		}
+
+		var D = step % 2 ? random() * 110 - 5 : Math.floor(random() * 100) + 0.5,
+			expected = closestByScan(live.slice().sort(function(x, y){ return x.index - y.index; }), D);
+		assert.strictEqual(cat.findItemInBank(D), expected, "step " + step + ", D " + D);
+		assert.strictEqual(cat.bankTable("rasch").length, items.length);
+	}
+});
+
+// Whether an item meets a content constraint, item by item
+var meets = function(item, c){
+	if (typeof c == "string") return (item.characteristics || []).indexOf(c) >= 0;
+	if (c.not) return !meets(item, c.not);
+	if (c.all) return c.all.every(function(part){ return meets(item, part); });
+	return c.any.some(function(part){ return meets(item, part); });
+}
+
+check("content filter bitmaps match the constraint item by item", function(){
+	var items = simpleBank(1000);
+	items.forEach(function(item){
+		item.characteristics = [];
+		for (var c = 0; c < 6; c++) if (random() < 0.3) item.characteristics.push("area" + c);
+	});
+	cat.useItemBank(items);
+
+	var constraints = [
+		"area0",
+		"missing",
+		{ not: "area1" },
+		{ all: ["area0", { any: ["area1", "area2"] }] },
+		{ any: [{ all: ["area3", { not: "area4" }] }, { not: { any: ["area5", "area0"] } }] }
+	];
+	constraints.forEach(function(constraint){
+		var words = cat.bankWords(),
+			mask = new Uint32Array(words).fill(0xffffffff);
+		content.createContentFilter(cat, constraint).filter({}, mask, words);
+		items.forEach(function(item, i){
+			assert.strictEqual((mask[i >>> 5] & (1 << (i & 31))) != 0, meets(item, constraint),
+				JSON.stringify(constraint) + " item " + i);
+		});
+	});
+
+	var given = [],
+		filter = content.createContentFilter(cat, function(candidate){
+			return given.length < 3 ? "area0" : { not: "area0" };
+		}),
+		answers = { administer: function(candidate, item){ given.push(item); return item.answer; } };
+	cat.registerAlgorithm(filter);
+	cat.registerAlgorithm(answers);
+	cat.setTestLength(5);
+
+	try {
+		cat.newCandidate({ name: "content", ability: 50 });
+		given.forEach(function(item, g){ assert.strictEqual(meets(item, "area0"), g < 3, item.question); });
+	}
+	finally {
+		cat.unregisterAlgorithm(filter);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("shadow test on a small bank stays within its time budget", function(){
+	var items = simpleBank(60);
+	items[0].difficulty = 50;
+	items.forEach(function(item, i){ item.characteristics = ["area" + (i % 5)]; });
+	cat.useItemBank(items);
+	cat.setTestLength(9);
+
+	var shadow = shadowTest.createShadowTest(cat, {
+			testLength: 10,
+			timeBudget: 50,
+			constraints: [{ characteristic: "area0", min: 2, max: 2 }, { characteristic: "area1", max: 1 }]
+		}),
+		answers = { administer: function(candidate, item){ return random() < 0.5 ? item.answer : ""; } };
+	cat.registerAlgorithm(shadow);
+	cat.registerAlgorithm(answers);
+
+	try {
+		var started = Date.now(),
+			result = cat.newCandidate({ name: "shadow", ability: 50 });
+		assert.strictEqual(result.itemsTaken, 10);
+		assert.strictEqual(shadow.violation, 0);
+		assert.ok(Date.now() - started < 10 * 50, "took " + (Date.now() - started) + " ms");
+	}
+	finally {
+		cat.unregisterAlgorithm(shadow);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("the first shadow test selection on a large bank stays near its time budget", function(){
+	var items = simpleBank(50000);
+	items.forEach(function(item, i){ item.characteristics = ["area" + (i % 50)]; });
+	cat.useItemBank(items);
+	cat.setTestLength(0);
+
+	var constraints = [];
+	for (var k = 0; k < 50; k++) constraints.push({ characteristic: "area" + k, max: 1 });
+	var shadow = shadowTest.createShadowTest(cat, { testLength: 20, timeBudget: 5, constraints: constraints }),
+		answers = { administer: function(candidate, item){ return item.answer; } };
+	cat.registerAlgorithm(shadow);
+	cat.registerAlgorithm(answers);
+
+	try {
+		var started = Date.now();
+		cat.newCandidate({ name: "large", ability: 50 });
+		assert.ok(Date.now() - started < 150, "took " + (Date.now() - started) + " ms");
+		assert.strictEqual(shadow.violation, 0);
+	}
+	finally {
+		cat.unregisterAlgorithm(shadow);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("PWKL picks the item that separates the patterns", function(){
+	var items = [
+			{ question: "sharp", answer: "1", difficulty: 50, attributes: [0], slip: 0.02, guess: 0.02 },
+			{ question: "flat", answer: "1", difficulty: 50, attributes: [0], slip: 0.3, guess: 0.5 }
+		],
+		first = null;
+	cat.useItemBank(items);
+	cat.setTestLength(0);
+
+	var selector = diagnosis.createPatternSelector(cat, diagnosis.patternTable(items, { attributes: 1 }),
+			{ logPrior: [Math.log(0.9), Math.log(0.1)] }),
+		answers = { administer: function(candidate, item){ first = first || item.question; return "1"; } };
+	cat.registerAlgorithm(selector);
+	cat.registerAlgorithm(answers);
+
+	try {
+		cat.newCandidate({ name: "pwkl", ability: 50 });
+		assert.strictEqual(first, "sharp");
+	}
+	finally {
+		cat.unregisterAlgorithm(selector);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("class rates match a tally of the classifications", function(){
+	var K = 4,
+		rates = diagnosis.createClassRates({ attributes: K, shards: 2 }),
+		other = diagnosis.openClassRates(rates.buffer, K, 2, 1),
+		seen = new Array(1 << K).fill(0),
+		exact = new Array(1 << K).fill(0),
+		right = new Array(K).fill(0),
+		total = 0;
+
+	// Half the examinees into each shard, about a third of them misclassified
+	for (var e = 0; e < 2000; e++){
+		var truth = Math.floor(random() * (1 << K)),
+			estimate = random() < 0.3 ? Math.floor(random() * (1 << K)) : truth;
+		(e % 2 ? other : rates).record(truth, estimate);
+		seen[truth]++;
+		if (estimate == truth) exact[truth]++;
+		for (var k = 0; k < K; k++) if (((truth ^ estimate) >>> k & 1) == 0) right[k]++;
+		total++;
+	}
+
+	var allExact = exact.reduce(function(a, b){ return a + b; }, 0);
+	assert.strictEqual(rates.examinees(), total);
+	assert.strictEqual(other.rate(), allExact / total);
+	for (var p = 0; p < (1 << K); p++){
+		assert.strictEqual(rates.examinees(p), seen[p]);
+		assert.strictEqual(rates.rate(p), seen[p] ? exact[p] / seen[p] : 0);
+	}
+	for (k = 0; k < K; k++) assert.strictEqual(rates.attributeRate(k), right[k] / total);
+
+	// Merging both shards into a fresh counter gives the same rates
+	var merged = diagnosis.createClassRates({ attributes: K });
+	merged.merge(rates);
+	assert.strictEqual(merged.examinees(), total);
+	assert.strictEqual(merged.rate(), rates.rate());
+	assert.strictEqual(merged.attributeRate(2), rates.attributeRate(2));
+
+	assert.throws(function(){ merged.merge(diagnosis.createClassRates({ attributes: 3 })); }, /attribute counts/);
+	assert.throws(function(){ diagnosis.openClassRates(rates.buffer, K, 3, 0); }, /does not match/);
+	assert.throws(function(){ diagnosis.createClassRates({ attributes: 25 }); }, /At most 24/);
+
+	rates.reset();
+	assert.strictEqual(other.examinees(), 0);
+	assert.strictEqual(other.rate(), 0);
+});
+
+check("SPRT, GLR and curtailment classify around the cut", function(){
+	var items = simpleBank(300),
+		right = true,
+		given = [],
+		answers = { administer: function(candidate, item){ given.push(item); return right ? item.answer : ""; } };
+	cat.useItemBank(items);
+	cat.registerAlgorithm(answers);
+
+	var run = function(options, testLength){
+		var rule = stopping.createClassificationRule(cat, options);
+		cat.registerAlgorithm(rule);
+		cat.setTestLength(testLength);
+		given.length = 0;
+		try {
+			var result = cat.newCandidate({ name: "classify", ability: 50 });
+			return { rule: rule, items: result.itemsTaken };
+		}
+		finally {
+			cat.unregisterAlgorithm(rule);
+		}
+	};
+
+	try {
+		// The SPRT ratio is the sum of log(P+ / P-) over the items given
+		var sprt = run({ cut: 0, delta: 0.3 }, 59),
+			expected = 0;
+		given.forEach(function(item){
+			var theta = itemResponse.scaleDifficulty(item.difficulty),
+				pHigh = itemResponse.logisticProbability(1, theta, 0, 0.3),
+				pLow = itemResponse.logisticProbability(1, theta, 0, -0.3);
+			expected += Math.log(pHigh / pLow);
+		});
+		assert.strictEqual(sprt.rule.reason, "sprt");
+		assert.strictEqual(sprt.rule.decision, "pass");
+		assert.ok(Math.abs(sprt.rule.ratio - expected) < 1e-9, sprt.rule.ratio + " vs " + expected);
+		assert.ok(sprt.rule.ratio >= Math.log(0.95 / 0.05));
+
+		right = false;
+		var glr = run({ cut: 0, delta: 0.3, glr: true }, 59);
+		assert.strictEqual(glr.rule.reason, "glr");
+		assert.strictEqual(glr.rule.decision, "fail");
+		assert.ok(glr.items < 60);
+
+		// Error rates too small to reach in 20 items: only curtailment can end early,
+		// and it must reach the decision the full length test ends with
+		right = true;
+		var strict = { cut: 0, delta: 0.3, alpha: 1e-12, beta: 1e-12 },
+			full = run(strict, 19),
+			curtailed = run(Object.assign({ curtail: true, maxItems: 20 }, strict), 19);
+		assert.strictEqual(full.items, 20);
+		assert.strictEqual(full.rule.reason, null);
+		assert.strictEqual(curtailed.rule.reason, "curtailed");
+		assert.ok(curtailed.items < 20, curtailed.items + " items");
+		assert.strictEqual(curtailed.rule.decision, full.rule.decision);
+
+		assert.throws(function(){ stopping.createClassificationRule(cat, { cut: 0, curtail: true }); }, /maxItems/);
+		assert.throws(function(){
+			stopping.createClassificationRule(cat, { cut: 0, curtail: true, maxItems: 20, glr: true });
+		}, /glr/);
+	}
+	finally {
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("a resumed GLR classification continues from its checkpoint", function(){
+	cat.useItemBank(simpleBank(300));
+	cat.setTestLength(59);
+
+	// Alternating right and wrong, so the ratio takes a while to leave the bounds
+	var rule = stopping.createClassificationRule(cat, { cut: 0.8, delta: 0.2, glr: true }),
+		checkpoint = null,
+		given = 0,
+		answers = {
+			administer: function(candidate, item){ return cat.administeredItems().length % 2 ? item.answer : ""; },
+			administered: function(candidate){ if (++given == 5) checkpoint = cat.serializeSession(candidate); }
+		};
+	cat.registerAlgorithm(rule);
+	cat.registerAlgorithm(answers);
+
+	try {
+		var finished = cat.newCandidate({ name: "glr", ability: 50 }),
+			ratio = rule.ratio,
+			decision = rule.decision,
+			reason = rule.reason;
+		assert.strictEqual(reason, "glr");
+		assert.ok(finished.itemsTaken > 10, finished.itemsTaken + " items");
+
+		var resumed = cat.resumeSession(checkpoint);
+		assert.strictEqual(resumed.itemsTaken, finished.itemsTaken);
+		assert.strictEqual(rule.ratio, ratio);
+		assert.strictEqual(rule.decision, decision);
+		assert.strictEqual(rule.reason, reason);
+	}
+	finally {
+		cat.unregisterAlgorithm(rule);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+
+// Exposure ==================================================================
+
+check("an exposure counter refuses items past its capacity before a test uses them", function(){
+	cat.useItemBank(simpleBank(10));
+	cat.setTestLength(4);
+
+	var counter = exposure.createExposureCounter({ items: 10, capacity: 11 }),
+		answered = 0,
+		answers = { administer: function(candidate, item){ answered++; return item.answer; } };
+	cat.registerAlgorithm(counter);
+	cat.registerAlgorithm(answers);
+
+	try {
+		cat.addItem({ question: "added", answer: "1", difficulty: 50 });
+		assert.throws(function(){
+			cat.addItem({ question: "no room", answer: "1", difficulty: 50 });
+		}, /room for 11 items/);
+		assert.strictEqual(cat.bankTable("rasch").length, 11);
+
+		cat.newCandidate({ name: "capacity", ability: 50 });
+		assert.strictEqual(counter.count(10), 1);
+
+		cat.unregisterAlgorithm(counter);
+		cat.useItemBank(simpleBank(20));
+		cat.registerAlgorithm(counter);
+		answered = 0;
+		assert.throws(function(){ cat.newCandidate({ name: "capacity", ability: 50 }); }, /room for 11 items/);
+		assert.strictEqual(answered, 0);
+	}
+	finally {
+		cat.unregisterAlgorithm(counter);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+check("conditional exposure control and MPI count added items and refuse them past capacity", function(){
+	var answers = { administer: function(candidate, item){ return item.answer; } };
+	cat.registerAlgorithm(answers);
+	cat.setTestLength(0);
+
+	try {
+		[
+			function(counter){
+				return exposure.createConditionalExposureControl(counter,
+					{ ability: function(candidate){ return candidate.ability; } });
+			},
+			function(counter){ return exposure.createMaximumPriorityIndex(cat, counter); }
+		].forEach(function(create){
+			cat.useItemBank(simpleBank(10));
+			var counter = exposure.createConditionalExposureCounter({ items: 10, capacity: 11 }),
+				control = create(counter);
+			cat.registerAlgorithm(control);
+
+			try {
+				var added = { question: "added", answer: "1", difficulty: 50 };
+				cat.addItem(added);
+				assert.throws(function(){
+					cat.addItem({ question: "no room", answer: "1", difficulty: 50 });
+				}, /room for 11 items/);
+
+				cat.newCandidate({ name: "conditional", ability: 50 });
+				assert.strictEqual(counter.count(added.index, counter.binOf(50)), 1);
+			}
+			finally {
+				cat.unregisterAlgorithm(control);
+			}
+		});
+	}
+	finally {
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+// Highest rate of any item in the bins with at least 100 examinees, less
+// the overshoot of 1 / examinees one administration past rMax can add
+var worstBinRate = function(counter, items){
+	var worst = 0;
+	for (var bin = 0; bin < counter.bins; bin++){
+		var examinees = counter.examinees(bin);
+		if (examinees < 100) continue;
+		for (var i = 0; i < items; i++) worst = Math.max(worst, counter.rate(i, bin) - 1 / examinees);
+	}
+	return worst;
+}
+
+check("a 2000 examinee simulation keeps every ability bin under rMax", function(){
+	var estimate = function(candidate){
+		var D = cat.getTheta(candidate, "estimate");
+		return isNaN(D) ? candidate.ability : D;
+	};
+	var answers = {
+		administer: function(candidate, item){
+			return random() < itemResponse.raschModel(item.difficulty, candidate.ability) ? item.answer : "";
+		}
+	};
+	cat.registerAlgorithm(answers);
+	cat.setTestLength(9);
+
+	try {
+		[
+			null,
+			function(counter){ return exposure.createConditionalExposureControl(counter, { rMax: 0.3, ability: estimate }); },
+			function(counter){ return exposure.createMaximumPriorityIndex(cat, counter, { rMax: 0.3 }); }
+		].forEach(function(create){
+			cat.useItemBank(simpleBank(200));
+			var counter = exposure.createConditionalExposureCounter({ items: 200 }),
+				control = create ? create(counter) : null,
+				record = { initialize: function(){ counter.beginExaminee(); },
+					administered: function(candidate, item){ counter.record(item.index, counter.binOf(estimate(candidate))); } };
+			cat.registerAlgorithm(control || record);
+
+			try {
+				for (var e = 0; e < 2000; e++){
+					var candidate = cat.acquireCandidate("simulee" + e, 1 + random() * 99);
+					cat.newCandidate(candidate);
+					cat.releaseCandidate(candidate);
+				}
+				// Without control the closest item to the start is given to everyone in a bin
+				if (!control) assert.ok(worstBinRate(counter, 200) > 0.5);
+				else assert.ok(worstBinRate(counter, 200) <= 0.3, control.name + " " + worstBinRate(counter, 200));
+			}
+			finally {
+				cat.unregisterAlgorithm(control || record);
+			}
+		});
+	}
+	finally {
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+// Routing module at 50, then easy / medium / hard modules at 20, 50, 80 in
+// stages two and three, five items each at bank positions 0 .. 34
+var mstPanel = function(){
+	var items = [],
+		levels = [50, 20, 50, 80, 20, 50, 80],
+		stages = [[], [], []];
+	levels.forEach(function(difficulty, m){
+		var module = { items: [] };
+		for (var i = 0; i < 5; i++){
+			module.items.push(items.length);
+			items.push({ question: "m" + m + "i" + i, answer: "1", difficulty: difficulty });
+		}
+		stages[m == 0 ? 0 : m < 4 ? 1 : 2].push(module);
+	});
+	cat.useItemBank(items);
+	return mst.assemblePanel(cat, { stages: stages });
+}
+
+check("an MST panel routes by number correct and the router follows it", function(){
+	var panel = mstPanel();
+
+	// Routing module: 0 right goes easy, 5 right goes hard, never downwards
+	var routed = [];
+	for (var right = 0; right <= 5; right++) routed.push(panel.nodeModule[panel.routes[panel.routeOffset[0] + right]]);
+	assert.strictEqual(routed[0], 1);
+	assert.strictEqual(routed[5], 3);
+	for (right = 1; right <= 5; right++) assert.ok(routed[right] >= routed[right - 1], routed.join());
+
+	var router = mst.createMstRouter(cat, panel),
+		correct = true,
+		given = [],
+		checkpoint = null,
+		answers = {
+			administer: function(candidate, item){ given.push(item.index); return correct ? item.answer : ""; },
+			administered: function(candidate){ if (given.length == 7) checkpoint = cat.serializeSession(candidate); }
+		};
+	cat.registerAlgorithm(router);
+	cat.registerAlgorithm(answers);
+	cat.setTestLength(20);
+
+	try {
+		var result = cat.newCandidate({ name: "mst", ability: 50 });
+		assert.strictEqual(result.itemsTaken, 15);
+		assert.deepStrictEqual(router.route, [0, 3, 6]);
+		assert.deepStrictEqual(given, [0, 1, 2, 3, 4, 15, 16, 17, 18, 19, 30, 31, 32, 33, 34]);
+
+		given.length = 0;
+		cat.resumeSession(checkpoint);
+		assert.deepStrictEqual(router.route, [0, 3, 6]);
+		assert.deepStrictEqual(given, [17, 18, 19, 30, 31, 32, 33, 34]);
+
+		correct = false;
+		given.length = 0;
+		cat.newCandidate({ name: "mst", ability: 50 });
+		assert.deepStrictEqual(router.route, [0, 1, 4]);
+	}
+	finally {
+		cat.unregisterAlgorithm(router);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+
+// Stopping and checkpoints ===================================================
+
+check("a resumed session carries on after an earlier test stopped early", function(){
+	cat.useItemBank(simpleBank(500));
+	cat.setTestLength(60);
+
+	var rule = stopping.createStoppingRule(cat, { standardError: 0.6, minItems: 5 }),
+		checkpoint = null,
+		given = 0,
+		answers = {
+			administer: function(candidate, item){
+				return random() < itemResponse.raschModel(item.difficulty, candidate.ability) ? item.answer : "";
+			},
+			administered: function(candidate){
+				if (++given == 3) checkpoint = cat.serializeSession(candidate);
+			}
+		};
+	cat.registerAlgorithm(rule);
+	cat.registerAlgorithm(answers);
+
+	try {
+		var finished = cat.newCandidate({ name: "resume", ability: 50 });
+		assert.strictEqual(rule.reason, "standardError");
+
+		var resumed = cat.resumeSession(checkpoint);
+		assert.ok(resumed.itemsTaken > 3, "stopped after " + resumed.itemsTaken + " items");
+		assert.strictEqual(resumed.itemsTaken, finished.itemsTaken);
+	}
+	finally {
+		cat.unregisterAlgorithm(rule);
+		cat.unregisterAlgorithm(answers);
+		cat.unregisterAlgorithm(rule.accumulator);
+	}
+});
+
+check("a stopping rule made after its accumulator was unregistered starts afresh", function(){
+	cat.useItemBank(simpleBank(200));
+	cat.setTestLength(60);
+
+	var answers = {
+			administer: function(candidate, item){
+				return random() < itemResponse.raschModel(item.difficulty, candidate.ability) ? item.answer : "";
+			}
+		},
+		taken = [],
+		accumulators = [];
+	cat.registerAlgorithm(answers);
+
+	try {
+		for (var run = 0; run < 2; run++){
+			var rule = stopping.createStoppingRule(cat, { standardError: 0.6 });
+			cat.registerAlgorithm(rule);
+			taken.push(cat.newCandidate({ name: "afresh", ability: 50 }).itemsTaken);
+			accumulators.push(rule.accumulator);
+			cat.unregisterAlgorithm(rule);
+			cat.unregisterAlgorithm(rule.accumulator);
+		}
+		assert.notStrictEqual(accumulators[0], accumulators[1]);
+		assert.ok(taken[1] > 5, "second test stopped after " + taken[1] + " items");
+
+		var shared = stopping.informationAccumulator(cat);
+		assert.strictEqual(stopping.informationAccumulator(cat), shared);
+		assert.throws(function(){
+			stopping.informationAccumulator(cat, { ability: function(candidate, D){ return 0; } });
+		}, /different ability/);
+		cat.unregisterAlgorithm(shared);
+	}
+	finally {
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+
+// Response log and replay ===================================================
+
+check("a closed response logger left registered does not break the next test", function(){
+	var dir = path.join(tempDir, "closed");
+	fs.mkdirSync(dir);
+	var logger = responseLog.createResponseLogger({ dir: dir }),
+		answers = { administer: function(candidate, item){ return item.answer; } };
+	logger.close();
+	cat.useItemBank(simpleBank(10));
+	cat.setTestLength(2);
+	cat.registerAlgorithm(logger);
+	cat.registerAlgorithm(answers);
+
+	try {
+		assert.strictEqual(cat.newCandidate({ name: "closed", ability: 50 }).itemsTaken, 3);
+	}
+	finally {
+		cat.unregisterAlgorithm(logger);
+		cat.unregisterAlgorithm(answers);
+	}
+});
+
+// The rest are asynchronous and run last, one after another. Each is a
+// function(next) calling next() once its checks are done.
+
+var asyncChecks = [];
+
+var logTwice = function(done){
+	var logged = 0;
+	var run = function(){
+		var logger = responseLog.createResponseLogger({ dir: tempDir });
+		logger.administered({ name: "log" + logged }, { index: 1 }, 1, 0.5);
+		logger.close(function(err){
+			if (err) return done(err);
+			if (++logged < 2) return run();
+			done(null);
+		});
+	};
+	try { run(); } catch (err){ done(err); }
+}
+
+var segments = function(){
+	return fs.readdirSync(tempDir).filter(function(file){ return /\.log$/.test(file); }).sort();
+}
+
+asyncChecks.push(function(next){
+	logTwice(function(err){
+		check("a second response logger in the same directory adds new segments", function(){
+			if (err) throw err;
+			assert.deepStrictEqual(segments(), ["responses-000001.log", "responses-000002.log"]);
+		});
+		next();
+	});
+});
+
+// Replays the two logged examinees one per batch, failing in the second
+var replayFailing = function(done){
+	cat.useItemBank(simpleBank(5));
+	cat.setTestLength(2);
+	var batches = 0;
+	replay.replaySessions(cat, replay.openResponseLog(segments().map(function(file){
+		return path.join(tempDir, file);
+	})), {
+		batchSize: 1,
+		onBatch: function(results){
+			if (++batches == 2) throw new Error("second batch failed");
+		},
+		done: done
+	});
+}
+
+asyncChecks.push(function(next){
+	var replayed = function(err, summary){
+		check("an error in a later replay batch reaches done", function(){
+			assert.ok(err && /second batch failed/.test(err.message), "done got " + err);
+			assert.strictEqual(summary, undefined);
+		});
+		next();
+	};
+	try { replayFailing(replayed); } catch (err){ replayed(err); }
+});
+
+// Four worker threads each record 100k administrations into their own shard
+asyncChecks.push(function(next){
+	var Worker = require('worker_threads').Worker,
+		counter = exposure.createExposureCounter({ items: 100, shards: 4 }),
+		running = 4,
+		errors = [];
+
+	var code = "var w = require('worker_threads'), d = w.workerData," +
+		" c = require(d.exposure).openExposureCounter(d.buffer, 100, 4, d.shard);" +
+		" for (var i = 0; i < 100000; i++){ if (i % 100 == 0) c.initialize({}); c.administered({}, { index: i % 100 }); }";
+
+	for (var shard = 0; shard < 4; shard++){
+		var worker = new Worker(code, { eval: true, workerData: {
+			exposure: path.join(__dirname, "exposure.js"), buffer: counter.buffer, shard: shard } });
+		worker.on('error', function(err){ errors.push(err); });
+		worker.on('exit', function(){
+			if (--running > 0) return;
+			check("exposure counts from four worker threads add up", function(){
+				if (errors.length) throw errors[0];
+				assert.strictEqual(counter.examinees(), 4000);
+				for (var i = 0; i < 100; i++) assert.strictEqual(counter.count(i), 4000);
+				assert.strictEqual(counter.rate(7), 1);
+			});
+			next();
+		});
+	}
+});
+
+asyncChecks.push(function(next){
+	var abilities = [];
+	for (var e = 0; e < 4000; e++) abilities.push(-3 + 6 * random());
+	mst.routingAccuracy(mstPanel(), { abilities: abilities, workers: 4 }, function(err, accuracy){
+		check("MST routing accuracy is simulated across worker threads", function(){
+			if (err) throw err;
+			assert.strictEqual(accuracy.simulees, 4000);
+			assert.strictEqual(accuracy.stage[0], 1);
+			assert.ok(accuracy.stage[1] > 0.6 && accuracy.stage[2] > 0.6, JSON.stringify(accuracy));
+			assert.ok(accuracy.path <= Math.min(accuracy.stage[1], accuracy.stage[2]));
+		});
+		next();
+	});
+});
+
+var runAsyncChecks = function(){
+	var next = asyncChecks.shift();
+	if (next) return next(runAsyncChecks);
+
+	fs.rmSync(tempDir, { recursive: true, force: true });
+	if (failures) console.log(failures + " failed");
+	process.exitCode = failures ? 1 : 0;
+}
+
+runAsyncChecks();